@@ -0,0 +1,479 @@
+/* keytrace - replay keys to te on a pseudo terminal and time them
+
+   keytrace [-s scale] [-t timeout] [-r rows] [-c cols] [-L ms] [-M mb]
+	    trace te [args]
+   keytrace -w trace te [args]
+
+   A trace is a line per chunk of keys, written to te at once:
+
+	delay[*count] keys
+
+   delay is how many ms to wait after te handled the chunk before,
+   count how often to send the chunk, 1 by default, and keys the rest
+   of the line, with \e, \r, \n, \t, \\ and \xHH escapes.  Lines
+   starting with # are comments.  -w records such a trace while te is
+   used as usual on this terminal, a line per read of the keyboard.
+
+   A chunk is handled when te wrote what it had to and all its threads
+   sleep while no input is waiting for it; its latency is until the
+   last byte te wrote, or until it was idle if it wrote nothing.  The
+   latencies go to stdout per chunk as it appears in the trace, in the
+   format of $TE_LATENCY, with the CPU time te used.  Linux only, as
+   that is known from /proc.
+
+   keytrace exits 1 when a chunk took longer than -L ms, or te's
+   resident memory got larger than -M mb, as ceilings for stress tests
+   on pathological files. */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+#define MAX(a, b)  ((a) < (b) ? (b) : (a))
+
+#define CHUNK_MAX 65536
+#define IDLE_POLLS 2            /* of 1 ms te must be idle for */
+
+typedef struct {
+	char keys[32];          /* of the chunk, as in the trace */
+	unsigned long *us;
+	size_t n, size;
+} Latency;
+
+static Latency *latency;
+static size_t latency_n;
+
+static pid_t te;
+static int master, slave;
+
+static unsigned long
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void
+die(const char *what)
+{
+	fprintf(stderr, "keytrace: %s: %s\n", what, strerror(errno));
+	exit(2);
+}
+
+/* Start te on a new pseudo terminal of ws */
+static void
+spawn(char *argv[], struct winsize *ws)
+{
+	if (openpty(&master, &slave, 0, 0, ws) < 0)
+		die("openpty");
+
+	te = fork();
+	if (te < 0)
+		die("fork");
+	if (te == 0) {
+		close(master);
+		setsid();
+		ioctl(slave, TIOCSCTTY, 0);
+		dup2(slave, 0);
+		dup2(slave, 1);
+		dup2(slave, 2);
+		if (slave > 2)
+			close(slave);
+		if (!getenv("TERM"))
+			setenv("TERM", "xterm", 1);
+		execvp(argv[0], argv);
+		die(argv[0]);
+	}
+	/* slave stays open here, to see what te has not read yet */
+}
+
+/* Decode the escapes of keys, returning the number of bytes */
+static size_t
+unescape(const char *s, char *out)
+{
+	size_t n = 0;
+
+	for (; *s; s++) {
+		if (*s != '\\' || !s[1]) {
+			out[n++] = *s;
+			continue;
+		}
+		switch (*++s) {
+		case 'e': out[n++] = 0x1b; break;
+		case 'r': out[n++] = '\r'; break;
+		case 'n': out[n++] = '\n'; break;
+		case 't': out[n++] = '\t'; break;
+		case 'x':
+			if (isxdigit((unsigned char)s[1])) {
+				char hex[3] = { s[1], s[2], 0 }, *end;
+				if (!isxdigit((unsigned char)hex[1]))
+					hex[1] = 0;
+				out[n++] = strtoul(hex, &end, 16);
+				s += end - hex;
+				break;
+			}
+			/* fall through */
+		default: out[n++] = *s;
+		}
+	}
+	return n;
+}
+
+static void
+escape(FILE *f, const char *s, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = s[i];
+		if (c == 0x1b)
+			fputs("\\e", f);
+		else if (c == '\r')
+			fputs("\\r", f);
+		else if (c == '\n')
+			fputs("\\n", f);
+		else if (c == '\t')
+			fputs("\\t", f);
+		else if (c == '\\')
+			fputs("\\\\", f);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(f, "\\x%02x", c);
+		else
+			fputc(c, f);
+	}
+}
+
+/* te exited, it is only waited for at the end, for its rusage */
+static int
+exited(void)
+{
+	siginfo_t info = { 0 };
+	return waitid(P_PID, te, &info, WEXITED | WNOHANG | WNOWAIT) < 0 ||
+	    info.si_pid == te;
+}
+
+/* All threads of te sleep, and it has read all keys sent */
+static int
+idle(void)
+{
+	char path[300], stat[512];
+	int waiting = 0, sleeping = 1;
+	struct dirent *d;
+	DIR *dir;
+
+	if (ioctl(slave, FIONREAD, &waiting) < 0 || waiting > 0)
+		return 0;
+
+	snprintf(path, sizeof path, "/proc/%d/task", (int)te);
+	if (!(dir = opendir(path)))
+		return 1;  /* te is gone */
+	while (sleeping && (d = readdir(dir))) {
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof path, "/proc/%d/task/%s/stat",
+		    (int)te, d->d_name);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+		size_t len = fread(stat, 1, sizeof stat - 1, f);
+		fclose(f);
+		stat[len] = 0;
+		/* pid (comm) state ..., and comm may have parens */
+		char *p = strrchr(stat, ')');
+		sleeping = !p || p[2] == 'S' || p[2] == 'Z';
+	}
+	closedir(dir);
+	return sleeping;
+}
+
+/* Write the len keys to te, reading what it writes meanwhile, until
+   it is idle or timeout us passed.  Returns when it wrote last, or 0
+   if it wrote nothing, or -1 if it exited. */
+static long
+drain(const char *keys, size_t len, unsigned long timeout)
+{
+	char buf[CHUNK_MAX];
+	unsigned long start = now_us(), last = 0;
+	int idle_polls = 0;
+
+	while (now_us() - start < timeout) {
+		struct pollfd fd = { master, POLLIN | (len ? POLLOUT : 0), 0 };
+		int r = poll(&fd, 1, 1);
+		if (r > 0 && (fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+			ssize_t n = read(master, buf, sizeof buf);
+			if (n <= 0)
+				return -1;
+			last = now_us();
+			idle_polls = 0;
+		} else if (r > 0 && (fd.revents & POLLOUT)) {
+			ssize_t n = write(master, keys, len);
+			if (n < 0)
+				return -1;
+			keys += n;
+			len -= n;
+		} else if (r == 0 && exited()) {
+			return -1;
+		} else if (r == 0 && !len && idle()) {
+			if (++idle_polls >= IDLE_POLLS)
+				break;
+		} else {
+			idle_polls = 0;
+		}
+	}
+	return last;
+}
+
+static Latency *
+latency_get(const char *keys)
+{
+	for (size_t i = 0; i < latency_n; i++)
+		if (strncmp(latency[i].keys, keys, sizeof latency[i].keys - 1) == 0)
+			return &latency[i];
+
+	Latency *l = realloc(latency, (latency_n + 1) * sizeof *l);
+	if (!l)
+		die("realloc");
+	latency = l;
+	l = &latency[latency_n++];
+	memset(l, 0, sizeof *l);
+	snprintf(l->keys, sizeof l->keys, "%s", keys);
+	return l;
+}
+
+static void
+latency_add(Latency *l, unsigned long us)
+{
+	if (l->n == l->size) {
+		l->size = MAX(64, 2 * l->size);
+		if (!(l->us = realloc(l->us, l->size * sizeof *l->us)))
+			die("realloc");
+	}
+	l->us[l->n++] = us;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+	return (x > y) - (x < y);
+}
+
+static unsigned long
+percentile(const Latency *l, double p)
+{
+	return l->us[MIN(l->n - 1, (size_t)(l->n * p / 100))];
+}
+
+static void
+report(const Latency *l)
+{
+	if (!l->n)
+		return;
+	qsort(l->us, l->n, sizeof *l->us, compare);
+	printf("%s latency: count %zu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu\n",
+	    l->keys, l->n, percentile(l, 50), percentile(l, 90),
+	    percentile(l, 99), percentile(l, 99.9), l->us[l->n - 1]);
+}
+
+static int
+replay(FILE *trace, double scale, unsigned long timeout, unsigned long max_ms)
+{
+	static char line[4 * CHUNK_MAX], keys[4 * CHUNK_MAX];
+	Latency all = { .keys = "all" };
+	unsigned long start = now_us();
+	int lineno = 0, gone = 0;
+
+	drain(0, 0, timeout);  /* te starting up */
+
+	while (!gone && fgets(line, sizeof line, trace)) {
+		unsigned long delay, count = 1;
+		char *s;
+
+		lineno++;
+		line[strcspn(line, "\n")] = 0;
+		if (!*line || *line == '#')
+			continue;
+		delay = strtoul(line, &s, 10);
+		if (*s == '*')
+			count = strtoul(s + 1, &s, 10);
+		if (*s != ' ' && *s != '\t') {
+			fprintf(stderr, "keytrace: line %d: delay keys wanted\n",
+			    lineno);
+			return 2;
+		}
+		size_t len = unescape(s + 1, keys);
+		Latency *l = latency_get(s + 1);
+
+		while (!gone && count-- > 0) {
+			if (delay > 0) {
+				struct timespec ts = { 0, delay * scale * 1000000 };
+				ts.tv_sec = ts.tv_nsec / 1000000000;
+				ts.tv_nsec %= 1000000000;
+				nanosleep(&ts, 0);
+				drain(0, 0, timeout);  /* what te did meanwhile */
+			}
+
+			unsigned long t = now_us();
+			long last = drain(keys, len, timeout);
+			if (last < 0)
+				gone = 1;
+			unsigned long us = (last > 0 ? (unsigned long)last : now_us()) - t;
+			latency_add(l, us);
+			latency_add(&all, us);
+		}
+	}
+
+	for (size_t i = 0; i < latency_n; i++)
+		report(&latency[i]);
+	report(&all);
+	printf("wall: %.3f s\n", (now_us() - start) / 1e6);
+	if (max_ms && all.n && all.us[all.n - 1] > max_ms * 1000) {
+		printf("keytrace: latency %lu ms over %lu ms\n",
+		    all.us[all.n - 1] / 1000, max_ms);
+		return 1;
+	}
+	return 0;
+}
+
+static struct termios saved;
+
+static void
+restore(void)
+{
+	tcsetattr(0, TCSAFLUSH, &saved);
+}
+
+static int
+record(FILE *trace)
+{
+	char buf[CHUNK_MAX];
+	unsigned long last = now_us();
+	struct termios raw;
+
+	if (tcgetattr(0, &saved) < 0)
+		die("tcgetattr");
+	raw = saved;
+	cfmakeraw(&raw);
+	tcsetattr(0, TCSAFLUSH, &raw);
+	atexit(restore);
+	close(slave);  /* so reading master fails once te exited */
+
+	fprintf(trace, "# keytrace\n");
+	for (;;) {
+		struct pollfd fds[2] = { { 0, POLLIN, 0 }, { master, POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		if (fds[1].revents) {
+			ssize_t n = read(master, buf, sizeof buf);
+			if (n <= 0)
+				break;
+			if (write(1, buf, n) < 0)
+				break;
+		}
+		if (fds[0].revents) {
+			ssize_t n = read(0, buf, sizeof buf);
+			if (n <= 0)
+				break;
+			unsigned long t = now_us();
+			fprintf(trace, "%lu ", (t - last) / 1000);
+			escape(trace, buf, n);
+			fputc('\n', trace);
+			last = t;
+			if (write(master, buf, n) < 0)
+				break;
+		}
+	}
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: keytrace [-s scale] [-t timeout] [-r rows] "
+	    "[-c cols] [-L ms] [-M mb] trace te [args]\n"
+	    "       keytrace -w trace te [args]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+	unsigned long timeout = 10000000, max_ms = 0, max_mb = 0;
+	double scale = 1;
+	const char *out = 0;
+	int c, rc;
+
+	while ((c = getopt(argc, argv, "+s:t:r:c:w:L:M:")) != -1) {
+		switch (c) {
+		case 's': scale = atof(optarg); break;
+		case 't': timeout = atof(optarg) * 1000000; break;
+		case 'r': ws.ws_row = atoi(optarg); break;
+		case 'c': ws.ws_col = atoi(optarg); break;
+		case 'w': out = optarg; break;
+		case 'L': max_ms = strtoul(optarg, 0, 10); break;
+		case 'M': max_mb = strtoul(optarg, 0, 10); break;
+		default: usage();
+		}
+	}
+
+	if (out) {
+		if (argc - optind < 1)
+			usage();
+		FILE *trace = fopen(out, "w");
+		if (!trace)
+			die(out);
+		ioctl(0, TIOCGWINSZ, &ws);
+		spawn(argv + optind, &ws);
+		rc = record(trace);
+		fclose(trace);
+	} else {
+		if (argc - optind < 2)
+			usage();
+		FILE *trace = strcmp(argv[optind], "-") == 0 ? stdin :
+		    fopen(argv[optind], "r");
+		if (!trace)
+			die(argv[optind]);
+		spawn(argv + optind + 1, &ws);
+		rc = replay(trace, scale, timeout, max_ms);
+	}
+
+	/* te should have quit at the end of the trace */
+	struct rusage ru;
+	int status;
+	pid_t pid = wait4(te, &status, WNOHANG, &ru);
+	if (pid == 0) {
+		kill(te, SIGTERM);
+		pid = wait4(te, &status, 0, &ru);
+	}
+	if (pid == te && !out)
+		printf("cpu: user %.3f s sys %.3f s maxrss %ld kB\n",
+		    ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+		    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+		    ru.ru_maxrss);
+	if (pid == te && !out && max_mb && ru.ru_maxrss > (long)max_mb * 1024) {
+		printf("keytrace: maxrss %ld MB over %lu MB\n",
+		    ru.ru_maxrss / 1024, max_mb);
+		rc = rc ? rc : 1;
+	}
+	return rc;
+}
@@ -0,0 +1,454 @@
+/* stress - libtext on pathological input, with ceilings on time and memory
+
+   stress [-g] [-d dir] [-m max] [-s scale] [case...]
+
+   The corpora are files in dir, $TMPDIR or /tmp, generated when they
+   are missing or of another size, and texts edited in memory:
+
+	longline   one line of 1G, a lone " in its middle
+	invalid    64M of bytes that are never UTF-8, no newline
+	brackets   64M of ([{ nested ever deeper, then closed, and a "
+	           on each line that is never closed
+	pieces     a million lines, each edited at its start: 2M pieces
+	undo       the same with a snapshot after each edit: 1M revisions
+
+   -g only generates the files, for keytrace to show them in te, -m
+   makes them max bytes at most.  Each case runs in a process of its
+   own forked after its corpus was made, and fails when it took longer
+   than its ceiling times scale, or its address space grew by more than
+   its ceiling; one over twice its time is killed.  The exit status is
+   1 if any case failed.  Given cases, by corpus or corpus/name, only
+   those run. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../vis/text.h"
+#include "../vis/text-motions.h"
+#include "../vis/text-regex.h"
+size_t text_undo_emacs(Text *txt, int n);
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+#define MAX(a, b)  ((a) < (b) ? (b) : (a))
+
+#define LINES_SIZE 11888896UL   /* of a million lines, as gen_lines writes them */
+#define LIMITS 8192             /* around point, as te matches brackets */
+#define ABSENT "the slow brown fox"
+
+static struct {
+	const char *dir;
+	size_t max;
+	double scale;
+} stress;
+
+static volatile size_t sink;  /* so the results are not left out */
+
+static unsigned long
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void
+die(const char *what)
+{
+	fprintf(stderr, "stress: %s: %s\n", what, strerror(errno));
+	exit(2);
+}
+
+/* kB of address space, now or at most so far */
+static unsigned long
+vm_kb(const char *field)
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	char line[256];
+	unsigned long kb = 0;
+	size_t len = strlen(field);
+
+	if (!f)
+		die("/proc/self/status");
+	while (fgets(line, sizeof line, f))
+		if (strncmp(line, field, len) == 0 && line[len] == ':')
+			kb = strtoul(line + len + 1, 0, 10);
+	fclose(f);
+	return kb;
+}
+
+/* Write size bytes to f, unit after unit */
+static void
+fill(FILE *f, const char *file, const char *unit, size_t len, size_t size)
+{
+	for (size_t n = 0; n < size; n += len)
+		if (fwrite(unit, 1, MIN(len, size - n), f) != MIN(len, size - n))
+			die(file);
+}
+
+static void
+gen_longline(FILE *f, const char *file, size_t size)
+{
+	static const char unit[] = "the quick brown fox (jumps) over the lazy dog ";
+
+	fill(f, file, unit, sizeof unit - 1, size / 2);
+	fputc('"', f);
+	fill(f, file, unit, sizeof unit - 1, size - size / 2 - 1);
+}
+
+static void
+gen_invalid(FILE *f, const char *file, size_t size)
+{
+	char unit[72];
+	size_t n = 0;
+
+	/* continuation bytes on their own, and bytes never in UTF-8 */
+	for (int c = 0x80; c <= 0xbf; c++)
+		unit[n++] = c;
+	for (int c = 0xf8; c <= 0xff; c++)
+		unit[n++] = c;
+	fill(f, file, unit, n, size);
+}
+
+static void
+gen_brackets(FILE *f, const char *file, size_t size)
+{
+	static const char open[] = "([{([{([{([{([{([{([{([{ \"unbalanced ([{([{([{([{([{([{\n";
+	static const char close[] = "}])}])}])}])}])}])}])}])}])}])}])}])}])}])}])}])}])}])\n";
+
+	fill(f, file, open, sizeof open - 1, size / 2);
+	fill(f, file, close, sizeof close - 1, size - size / 2);
+}
+
+static void
+gen_lines(FILE *f, const char *file, size_t size)
+{
+	char line[32];
+
+	for (size_t i = 1, n = 0; n < size; i++) {
+		size_t len = snprintf(line, sizeof line, "line %zu\n", i);
+		fill(f, file, line, len, MIN(len, size - n));
+		n += len;
+	}
+}
+
+/* an edit at the start of each line, from the last one up, so the
+   pieces before it stay few and each edit is quick */
+static void
+edit_lines(Text *txt, int snapshot)
+{
+	size_t pos = text_size(txt);
+
+	while (pos > 0) {
+		pos = text_line_begin(txt, pos - 1);
+		if (!text_insert(txt, pos, "x", 1))
+			die("text_insert");
+		if (snapshot)
+			text_snapshot(txt);
+	}
+}
+
+typedef struct {
+	const char *name;
+	const char *file;
+	size_t size;
+	void (*generate)(FILE *, const char *, size_t);
+	int edits;              /* 1 scattered, 2 with a snapshot each */
+} Corpus;
+
+static const Corpus corpora[] = {
+	{ "longline", "stress-longline.txt", 1UL << 30, gen_longline, 0 },
+	{ "invalid", "stress-invalid.txt", 64UL << 20, gen_invalid, 0 },
+	{ "brackets", "stress-brackets.txt", 64UL << 20, gen_brackets, 0 },
+	{ "pieces", "stress-lines.txt", LINES_SIZE, gen_lines, 1 },
+	{ "undo", "stress-lines.txt", LINES_SIZE, gen_lines, 2 },
+};
+
+static void
+path(const Corpus *c, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/%s", stress.dir, c->file);
+}
+
+static size_t
+corpus_size(const Corpus *c)
+{
+	return MIN(c->size, stress.max);
+}
+
+/* Generate the file of c if it isn't there as it would be */
+static void
+generate(const Corpus *c)
+{
+	char file[4096], tmp[4200];
+	struct stat st;
+
+	path(c, file, sizeof file);
+	snprintf(tmp, sizeof tmp, "%s.tmp", file);
+	if (stat(file, &st) == 0 && (size_t)st.st_size == corpus_size(c))
+		return;
+
+	fprintf(stderr, "stress: generating %s\n", file);
+	FILE *f = fopen(tmp, "w");
+	if (!f)
+		die(tmp);
+	c->generate(f, tmp, corpus_size(c));
+	if (fclose(f) != 0)
+		die(tmp);
+	if (rename(tmp, file) < 0)
+		die(file);
+}
+
+static Text *
+load(const Corpus *c)
+{
+	char file[4096];
+
+	path(c, file, sizeof file);
+	Text *txt = text_load(file);
+	if (!txt)
+		die(file);
+	if (c->edits)
+		edit_lines(txt, c->edits == 2);
+	return txt;
+}
+
+/* The cases, each a call te makes, or libtext makes for it */
+
+static void
+width_middle(Text *txt)
+{
+	sink += text_line_width_set(txt, text_size(txt) / 2, 1000);
+}
+
+static void
+width_million(Text *txt)
+{
+	sink += text_line_width_set(txt, 0, 1000000);
+}
+
+static size_t
+bracket(Text *txt, size_t pos, int limited)
+{
+	Filerange limits = { pos - MIN(pos, LIMITS / 2), pos + LIMITS / 2 };
+	return text_bracket_match_symbol(txt, pos, "(){}[]\"'`",
+	    limited ? &limits : 0);
+}
+
+/* the " in the middle of the line, with none near */
+static void
+bracket_quote(Text *txt)
+{
+	sink += bracket(txt, text_size(txt) / 2, 1);
+}
+
+static void
+bracket_first(Text *txt)
+{
+	sink += bracket(txt, 0, 1);
+}
+
+static void
+bracket_first_unlimited(Text *txt)
+{
+	sink += bracket(txt, 0, 0);
+}
+
+static void
+bracket_middle(Text *txt)
+{
+	size_t pos = text_line_begin(txt, text_size(txt) / 2);
+	sink += bracket(txt, pos, 1);
+}
+
+static void
+find_absent(Text *txt)
+{
+	sink += text_find_next(txt, 0, ABSENT);
+}
+
+static void
+regex_absent(Text *txt)
+{
+	Regex *regex = text_regex_new();
+	RegexMatch match[1];
+
+	if (!regex || text_regex_compile(regex, "slow [a-z]+ fox", REG_EXTENDED) != 0)
+		die("text_regex_compile");
+	sink += text_search_range_forward(txt, 0, text_size(txt), regex,
+	    1, match, 0);
+	text_regex_free(regex);
+}
+
+static void
+undo_once(Text *txt)
+{
+	sink += text_undo_emacs(txt, 0);
+}
+
+/* C-_ typed five times, each going further back */
+static void
+undo_five(Text *txt)
+{
+	for (int n = 0; n < 5; n++)
+		sink += text_undo_emacs(txt, n);
+}
+
+typedef struct {
+	const char *corpus, *name;
+	void (*run)(Text *);
+	unsigned long ms, mb;   /* the ceilings */
+} Case;
+
+static const Case cases[] = {
+	{ "longline", "line_width_set", width_middle, 500, 16 },
+	{ "longline", "bracket_quote", bracket_quote, 100, 16 },
+	{ "longline", "find_next", find_absent, 2000, 16 },
+	{ "longline", "regex_search", regex_absent, 10000, 16 },
+	{ "invalid", "line_width_set", width_million, 1000, 16 },
+	{ "invalid", "find_next", find_absent, 200, 16 },
+	{ "invalid", "regex_search", regex_absent, 500, 16 },
+	{ "brackets", "bracket_first", bracket_first, 100, 16 },
+	{ "brackets", "bracket_middle", bracket_middle, 100, 16 },
+	{ "brackets", "bracket_unlimited", bracket_first_unlimited, 1500, 16 },
+	{ "brackets", "regex_search", regex_absent, 500, 16 },
+	{ "pieces", "line_width_set", width_middle, 3000, 16 },
+	{ "pieces", "bracket_middle", bracket_middle, 500, 16 },
+	{ "pieces", "find_next", find_absent, 500, 16 },
+	{ "pieces", "regex_search", regex_absent, 30000, 16 },
+	{ "pieces", "undo", undo_once, 3000, 64 },
+	{ "undo", "undo", undo_once, 1000, 64 },
+	{ "undo", "undo_five", undo_five, 4000, 64 },
+};
+
+static int
+wanted(const Case *c, int argc, char *argv[])
+{
+	char full[256];
+
+	if (argc == 0)
+		return 1;
+	snprintf(full, sizeof full, "%s/%s", c->corpus, c->name);
+	for (int i = 0; i < argc; i++)
+		if (strcmp(argv[i], c->corpus) == 0 || strcmp(argv[i], full) == 0)
+			return 1;
+	return 0;
+}
+
+/* Run c on txt in a process of its own, 0 if it kept to its ceilings */
+static int
+run(const Case *c, Text *txt)
+{
+	unsigned long ms = c->ms * stress.scale;
+	int status;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		unsigned long vm = vm_kb("VmSize");
+		alarm(2 * ms / 1000 + 1);
+		unsigned long t = now_us();
+		c->run(txt);
+		double took = (now_us() - t) / 1000.0;
+		double grew = (vm_kb("VmPeak") - vm) / 1024.0;
+		int over_time = took > ms, over_mb = grew > c->mb;
+		printf("%-10s %-18s %10.1f ms %s%6lu  %8.1f MB %s%4lu  %s\n",
+		    c->corpus, c->name, took, over_time ? ">" : "<", ms,
+		    grew, over_mb ? ">" : "<", c->mb,
+		    over_time || over_mb ? "FAIL" : "ok");
+		exit(over_time || over_mb);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		die("waitpid");
+	if (WIFSIGNALED(status)) {
+		printf("%-10s %-18s killed by %s after twice its %lu ms  FAIL\n",
+		    c->corpus, c->name, strsignal(WTERMSIG(status)), ms);
+		return 1;
+	}
+	return WEXITSTATUS(status) != 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: stress [-g] [-d dir] [-m max] [-s scale] "
+	    "[case...]\n");
+	exit(2);
+}
+
+/* sizes like 64k, 16M or 2G */
+static size_t
+parse_size(const char *s)
+{
+	char *end;
+	size_t n = strtoull(s, &end, 10);
+	switch (*end) {
+	case 'k': case 'K': n <<= 10; end++; break;
+	case 'm': case 'M': n <<= 20; end++; break;
+	case 'g': case 'G': n <<= 30; end++; break;
+	}
+	if (*end || !n)
+		usage();
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, only_generate = 0, failed = 0;
+
+	setlocale(LC_ALL, "");  /* as te, for the width of characters */
+	stress.dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	stress.max = SIZE_MAX;
+	stress.scale = 1;
+	while ((c = getopt(argc, argv, "gd:m:s:")) != -1) {
+		switch (c) {
+		case 'g': only_generate = 1; break;
+		case 'd': stress.dir = optarg; break;
+		case 'm': stress.max = parse_size(optarg); break;
+		case 's': stress.scale = atof(optarg); break;
+		default: usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	for (size_t i = 0; i < sizeof corpora / sizeof corpora[0]; i++) {
+		const Corpus *corpus = &corpora[i];
+		Text *txt = 0;
+
+		for (size_t j = 0; j < sizeof cases / sizeof cases[0]; j++) {
+			const Case *k = &cases[j];
+			if (strcmp(k->corpus, corpus->name) != 0 ||
+			    (!only_generate && !wanted(k, argc, argv)))
+				continue;
+			generate(corpus);
+			if (only_generate)
+				break;
+			if (!txt) {
+				unsigned long t = now_us();
+				txt = load(corpus);
+				fprintf(stderr, "stress: %s made in %.1f s\n",
+				    corpus->name, (now_us() - t) / 1e6);
+			}
+			failed |= run(k, txt);
+		}
+		if (txt)
+			text_free(txt);
+	}
+
+	return failed;
+}
@@ -0,0 +1,517 @@
+/* textbench - time the operations of libtext on files of many sizes
+
+   textbench [-m max] [-d dir] [-c commit] [-o file]
+
+   Files from 1k up to max bytes, 1G by default, are generated in dir,
+   $TMPDIR or /tmp, and loaded, edited, read and saved.  Each operation
+   runs until it took 0.2 s or so, on a fresh text when it changes it,
+   and the mean time per operation goes to file or stdout as JSON:
+
+	{ "commit": "...", "results": [
+	  { "name": "text_insert", "variant": "random", "size": 1024,
+	    "pieces": "edited", "ops": 10000, "ns_per_op": 86.2,
+	    "mb_per_s": 0 }, ... ] }
+
+   Reads are timed on the text as loaded, one piece, and after EDITS
+   scattered edits.  Walks over the text stop after WALK_MAX bytes, and
+   lookups and walks when they took 0.2 s, as they get slow over many
+   pieces. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../vis/text.h"
+#include "../vis/text-motions.h"
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+#define MAX(a, b)  ((a) < (b) ? (b) : (a))
+
+#define MIN_NS 200000000UL      /* an operation runs this long at least */
+#define MAX_RUNS 1000
+#define EDITS 10000
+#define MARKS 1000
+#define WALK_MAX (256UL << 20)
+
+static const size_t sizes[] = {
+	1UL << 10, 64UL << 10, 1UL << 20, 16UL << 20, 256UL << 20,
+	1UL << 30, 4UL << 30,
+};
+
+static struct {
+	const char *dir;
+	char file[4096];        /* of the size being timed */
+	char out[4096];         /* saved and written to */
+	size_t size;
+	FILE *json;
+	int results;
+	unsigned long random;
+	unsigned long deadline; /* of the run */
+} bench;
+
+static unsigned long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* lookups and walks stop when a run took MIN_NS, after n of them */
+static int
+late(unsigned long n)
+{
+	return n > 0 && now_ns() > bench.deadline;
+}
+
+static void
+die(const char *what)
+{
+	fprintf(stderr, "textbench: %s: %s\n", what, strerror(errno));
+	exit(2);
+}
+
+/* xorshift, the same numbers each time */
+static size_t
+rnd(size_t n)
+{
+	bench.random ^= bench.random << 13;
+	bench.random ^= bench.random >> 7;
+	bench.random ^= bench.random << 17;
+	return n ? bench.random % n : 0;
+}
+
+/* Write a file of size bytes, lines of text with some UTF-8 in them */
+static void
+generate(const char *file, size_t size)
+{
+	FILE *f = fopen(file, "w");
+	char line[128];
+	size_t n = 0;
+
+	if (!f)
+		die(file);
+	for (size_t i = 0; n < size; i++) {
+		int len = snprintf(line, sizeof line,
+		    "%zu: the quick brown fox jümps over the läzy dog %zu\n",
+		    i, i * 7919 % 100003);
+		len = MIN((size_t)len, size - n);
+		if (fwrite(line, 1, len, f) != (size_t)len)
+			die(file);
+		n += len;
+	}
+	if (fclose(f) != 0)
+		die(file);
+}
+
+static Text *
+load(enum TextLoadMethod method)
+{
+	Text *txt = text_load_method(bench.file, method);
+	if (!txt)
+		die(bench.file);
+	return txt;
+}
+
+/* Scatter EDITS small insertions over txt, so it has many pieces */
+static void
+scatter(Text *txt)
+{
+	for (int i = 0; i < EDITS; i++)
+		text_insert(txt, rnd(text_size(txt)), "xy", 2);
+}
+
+static void
+result(const char *name, const char *variant, const char *pieces,
+    unsigned long ops, unsigned long ns, unsigned long bytes)
+{
+	double mb_per_s = bytes && ns ? bytes / (ns / 1e9) / (1 << 20) : 0;
+
+	fprintf(bench.json, "%s\n  { \"name\": \"%s\", \"variant\": \"%s\", "
+	    "\"size\": %zu, \"pieces\": \"%s\", \"ops\": %lu, "
+	    "\"ns_per_op\": %.1f, \"mb_per_s\": %.1f }",
+	    bench.results++ ? "," : "", name, variant, bench.size, pieces,
+	    ops, ops ? (double)ns / ops : 0, mb_per_s);
+	fflush(bench.json);
+	fprintf(stderr, "%-20s %-10s %10zu %-6s %12.1f ns/op\n", name, variant,
+	    bench.size, pieces, ops ? (double)ns / ops : 0);
+}
+
+/* An operation timed: setup makes what run works on, untimed, and run
+   returns how many operations it did and bytes it went through */
+typedef struct {
+	const char *name, *variant;
+	enum {
+		NO_TEXT,        /* run loads its own */
+		SAME_TEXT,      /* run only reads the text */
+		FRESH_TEXT      /* run changes it, loaded again for each run */
+	} text;
+	int edited;             /* with edits scattered over it */
+	void (*setup)(Text *);
+	unsigned long (*run)(Text *, unsigned long *bytes);
+} Op;
+
+static Mark marks[MARKS];
+static volatile size_t sink;  /* so the lookups are not left out */
+static size_t positions[EDITS];
+
+static void
+setup_positions(Text *txt)
+{
+	for (int i = 0; i < EDITS; i++)
+		positions[i] = rnd(text_size(txt) + 1);
+}
+
+static void
+setup_lines(Text *txt)
+{
+	size_t lines = text_lineno_by_pos(txt, text_size(txt));
+	for (int i = 0; i < EDITS; i++)
+		positions[i] = 1 + rnd(lines);
+}
+
+static void
+setup_marks(Text *txt)
+{
+	for (int i = 0; i < MARKS; i++)
+		marks[i] = text_mark_set(txt, rnd(text_size(txt) + 1));
+	scatter(txt);  /* marks are found through the pieces */
+}
+
+static unsigned long
+run_load_read(Text *txt, unsigned long *bytes)
+{
+	(void)txt;
+	text_free(load(TEXT_LOAD_READ));
+	*bytes = bench.size;
+	return 1;
+}
+
+static unsigned long
+run_load_mmap(Text *txt, unsigned long *bytes)
+{
+	(void)txt;
+	text_free(load(TEXT_LOAD_MMAP));
+	*bytes = bench.size;
+	return 1;
+}
+
+static unsigned long
+run_insert_random(Text *txt, unsigned long *bytes)
+{
+	for (int i = 0; i < EDITS; i++)
+		text_insert(txt, MIN(positions[i], text_size(txt)), "abcdefgh", 8);
+	*bytes = 8 * EDITS;
+	return EDITS;
+}
+
+/* an insertion every so often, going through the text */
+static unsigned long
+run_insert_sequential(Text *txt, unsigned long *bytes)
+{
+	size_t step = bench.size / EDITS + 1;
+	for (size_t i = 0, pos = 0; i < EDITS; i++, pos += step + 8)
+		text_insert(txt, MIN(pos, text_size(txt)), "abcdefgh", 8);
+	*bytes = 8 * EDITS;
+	return EDITS;
+}
+
+/* a character at a time, a snapshot after each word as in te */
+static unsigned long
+run_insert_typing(Text *txt, unsigned long *bytes)
+{
+	static const char typed[] = "the quick brown fox ";
+	size_t pos = positions[0];
+	for (int i = 0; i < EDITS; i++) {
+		char c = typed[i % (sizeof typed - 1)];
+		text_insert(txt, pos++, &c, 1);
+		if (c == ' ')
+			text_snapshot(txt);
+	}
+	*bytes = EDITS;
+	return EDITS;
+}
+
+static unsigned long
+run_delete_random(Text *txt, unsigned long *bytes)
+{
+	int n = 0;
+	for (int i = 0; i < EDITS && text_size(txt) > 8; i++, n++)
+		text_delete(txt, rnd(text_size(txt) - 8), 8);
+	*bytes = 8 * n;
+	return n;
+}
+
+static unsigned long
+run_delete_sequential(Text *txt, unsigned long *bytes)
+{
+	size_t step = bench.size / EDITS + 1;
+	int n = 0;
+	for (size_t pos = 0; n < EDITS && pos + 8 <= text_size(txt); pos += step, n++)
+		text_delete(txt, pos, 8);
+	*bytes = 8 * n;
+	return n;
+}
+
+/* backspace, a character at a time */
+static unsigned long
+run_delete_typing(Text *txt, unsigned long *bytes)
+{
+	size_t pos = positions[0];
+	int n = 0;
+	for (; n < EDITS && pos > 0; n++)
+		text_delete(txt, --pos, 1);
+	*bytes = n;
+	return n;
+}
+
+static unsigned long
+run_mark_get(Text *txt, unsigned long *bytes)
+{
+	size_t sum = 0;
+	int n = 0;
+	for (; n < MARKS && !late(n); n++)
+		sum += text_mark_get(txt, marks[n]);
+	sink += sum;
+	*bytes = 0;
+	return n;
+}
+
+static unsigned long
+run_lineno_random(Text *txt, unsigned long *bytes)
+{
+	size_t sum = 0;
+	int n = 0;
+	for (; n < EDITS && !late(n); n++)
+		sum += text_lineno_by_pos(txt, MIN(positions[n], text_size(txt)));
+	sink += sum;
+	*bytes = 0;
+	return n;
+}
+
+/* down through the text, as scrolling does */
+static unsigned long
+run_lineno_sequential(Text *txt, unsigned long *bytes)
+{
+	size_t step = text_size(txt) / EDITS + 1, sum = 0;
+	int n = 0;
+	for (size_t pos = 0; pos <= text_size(txt) && !late(n); pos += step, n++)
+		sum += text_lineno_by_pos(txt, pos);
+	sink += sum;
+	*bytes = 0;
+	return n;
+}
+
+static unsigned long
+run_pos_by_lineno(Text *txt, unsigned long *bytes)
+{
+	size_t sum = 0;
+	int n = 0;
+	for (; n < EDITS && !late(n); n++)
+		sum += text_pos_by_lineno(txt, positions[n]);
+	sink += sum;
+	*bytes = 0;
+	return n;
+}
+
+static unsigned long
+run_walk_bytes(Text *txt, unsigned long *bytes)
+{
+	size_t n = 0, end = MIN(text_size(txt), WALK_MAX);
+	Iterator it = text_iterator_get(txt, 0);
+	char c;
+	for (text_iterator_byte_get(&it, &c); it.pos < end &&
+	    text_iterator_byte_next(&it, &c); )
+		if (++n % 4096 == 0 && late(n))
+			break;
+	*bytes = n;
+	return n;
+}
+
+static unsigned long
+run_walk_chars(Text *txt, unsigned long *bytes)
+{
+	size_t n = 0, end = MIN(text_size(txt), WALK_MAX);
+	Iterator it = text_iterator_get(txt, 0);
+	char c;
+	while (it.pos < end && text_iterator_char_next(&it, &c))
+		if (++n % 4096 == 0 && late(n))
+			break;
+	*bytes = it.pos;
+	return n;
+}
+
+static unsigned long
+run_find_next(Text *txt, unsigned long *bytes)
+{
+	text_find_next(txt, 0, "the slow brown fox");  /* never there */
+	*bytes = text_size(txt);
+	return 1;
+}
+
+static unsigned long
+run_bytes_get(Text *txt, unsigned long *bytes)
+{
+	static char buf[4096];
+	int n = 0;
+	for (; n < EDITS && !late(n); n++)
+		text_bytes_get(txt, MIN(positions[n], text_size(txt)), sizeof buf, buf);
+	*bytes = n * sizeof buf;
+	return n;
+}
+
+static unsigned long
+run_write_range(Text *txt, unsigned long *bytes)
+{
+	int fd = open(bench.out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die(bench.out);
+	Filerange r = { 0, text_size(txt) };
+	if (text_write_range(txt, &r, fd) < 0)
+		die(bench.out);
+	close(fd);
+	*bytes = text_size(txt);
+	return 1;
+}
+
+static unsigned long
+run_save(Text *txt, unsigned long *bytes)
+{
+	if (!text_save(txt, bench.out))
+		die(bench.out);
+	*bytes = text_size(txt);
+	return 1;
+}
+
+static const Op ops[] = {
+	{ "text_load", "read", NO_TEXT, 0, 0, run_load_read },
+	{ "text_load", "mmap", NO_TEXT, 0, 0, run_load_mmap },
+	{ "text_insert", "random", FRESH_TEXT, 0, setup_positions, run_insert_random },
+	{ "text_insert", "sequential", FRESH_TEXT, 0, 0, run_insert_sequential },
+	{ "text_insert", "typing", FRESH_TEXT, 0, setup_positions, run_insert_typing },
+	{ "text_delete", "random", FRESH_TEXT, 0, 0, run_delete_random },
+	{ "text_delete", "sequential", FRESH_TEXT, 0, 0, run_delete_sequential },
+	{ "text_delete", "typing", FRESH_TEXT, 0, setup_positions, run_delete_typing },
+	{ "text_mark_get", "random", SAME_TEXT, 0, setup_marks, run_mark_get },
+	{ "text_lineno_by_pos", "random", SAME_TEXT, 0, setup_positions, run_lineno_random },
+	{ "text_lineno_by_pos", "random", SAME_TEXT, 1, setup_positions, run_lineno_random },
+	{ "text_lineno_by_pos", "sequential", SAME_TEXT, 0, 0, run_lineno_sequential },
+	{ "text_lineno_by_pos", "sequential", SAME_TEXT, 1, 0, run_lineno_sequential },
+	{ "text_pos_by_lineno", "random", SAME_TEXT, 0, setup_lines, run_pos_by_lineno },
+	{ "text_pos_by_lineno", "random", SAME_TEXT, 1, setup_lines, run_pos_by_lineno },
+	{ "text_iterator", "bytes", SAME_TEXT, 0, 0, run_walk_bytes },
+	{ "text_iterator", "bytes", SAME_TEXT, 1, 0, run_walk_bytes },
+	{ "text_iterator", "chars", SAME_TEXT, 0, 0, run_walk_chars },
+	{ "text_iterator", "chars", SAME_TEXT, 1, 0, run_walk_chars },
+	{ "text_find_next", "absent", SAME_TEXT, 0, 0, run_find_next },
+	{ "text_find_next", "absent", SAME_TEXT, 1, 0, run_find_next },
+	{ "text_bytes_get", "random", SAME_TEXT, 0, setup_positions, run_bytes_get },
+	{ "text_bytes_get", "random", SAME_TEXT, 1, setup_positions, run_bytes_get },
+	{ "text_write_range", "all", SAME_TEXT, 0, 0, run_write_range },
+	{ "text_write_range", "all", SAME_TEXT, 1, 0, run_write_range },
+	{ "text_save", "auto", SAME_TEXT, 1, 0, run_save },
+};
+
+static void
+time_op(const Op *op)
+{
+	unsigned long ns = 0, n = 0, bytes = 0;
+	Text *txt = 0;
+
+	bench.random = 88172645463325252UL;
+	for (int runs = 0; runs < MAX_RUNS && ns < MIN_NS; runs++) {
+		if (op->text == FRESH_TEXT || (op->text == SAME_TEXT && !txt)) {
+			if (txt)
+				text_free(txt);
+			txt = load(TEXT_LOAD_AUTO);
+			if (op->edited)
+				scatter(txt);
+			if (op->setup)
+				op->setup(txt);
+		}
+		unsigned long b = 0, t = now_ns();
+		bench.deadline = t + MIN_NS;
+		n += op->run(txt, &b);
+		ns += now_ns() - t;
+		bytes += b;
+	}
+	if (txt)
+		text_free(txt);
+
+	result(op->name, op->variant, op->edited ? "edited" : "loaded",
+	    n, ns, bytes);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: textbench [-m max] [-d dir] [-c commit] "
+	    "[-o file]\n");
+	exit(2);
+}
+
+/* sizes like 64k, 16M or 2G */
+static size_t
+parse_size(const char *s)
+{
+	char *end;
+	size_t n = strtoull(s, &end, 10);
+	switch (*end) {
+	case 'k': case 'K': n <<= 10; end++; break;
+	case 'm': case 'M': n <<= 20; end++; break;
+	case 'g': case 'G': n <<= 30; end++; break;
+	}
+	if (*end || !n)
+		usage();
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t max = 1UL << 30;
+	const char *commit = "", *out = 0;
+	int c;
+
+	bench.dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	while ((c = getopt(argc, argv, "m:d:c:o:")) != -1) {
+		switch (c) {
+		case 'm': max = parse_size(optarg); break;
+		case 'd': bench.dir = optarg; break;
+		case 'c': commit = optarg; break;
+		case 'o': out = optarg; break;
+		default: usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	bench.json = out ? fopen(out, "w") : stdout;
+	if (!bench.json)
+		die(out);
+	snprintf(bench.file, sizeof bench.file, "%s/textbench.%d",
+	    bench.dir, (int)getpid());
+	snprintf(bench.out, sizeof bench.out, "%s/textbench.%d.out",
+	    bench.dir, (int)getpid());
+
+	fprintf(bench.json, "{ \"commit\": \"%s\", \"results\": [", commit);
+	for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		if (sizes[i] > max)
+			break;
+		bench.size = sizes[i];
+		generate(bench.file, bench.size);
+		for (size_t j = 0; j < sizeof ops / sizeof ops[0]; j++)
+			time_op(&ops[j]);
+		unlink(bench.file);
+		unlink(bench.out);
+	}
+	fprintf(bench.json, "\n] }\n");
+
+	return fclose(bench.json) != 0;
+}
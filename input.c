@@ -0,0 +1,505 @@
+/* input - te's own key reader, see input.h */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <curses.h>
+
+#define INPUT_IMPL
+#include "input.h"
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+#define MAX(a, b)  ((a) < (b) ? (b) : (a))
+
+#define ESC 0x1b
+#define ESC_MIN_MS 5
+#define ESC_MAX_MS 200
+#define QUIT 0x07               /* C-g */
+#define BS 0x08                 /* C-h */
+#define PLAY_POLL 1024          /* keys replayed between looks for C-g */
+
+/* Escape sequences: CSI or SS3, then maybe numbers, then final */
+static const struct {
+	char final;
+	int number;             /* the first one, for ~ */
+	int key;
+} keys[] = {
+	{ 'A', 0, KEY_UP },
+	{ 'B', 0, KEY_DOWN },
+	{ 'C', 0, KEY_RIGHT },
+	{ 'D', 0, KEY_LEFT },
+	{ 'H', 0, KEY_HOME },
+	{ 'F', 0, KEY_END },
+	{ 'Z', 0, KEY_BTAB },
+	{ '~', 1, KEY_HOME },
+	{ '~', 2, KEY_IC },
+	{ '~', 3, KEY_DC },
+	{ '~', 4, KEY_END },
+	{ '~', 5, KEY_PPAGE },
+	{ '~', 6, KEY_NPAGE },
+	{ '~', 7, KEY_HOME },
+	{ '~', 8, KEY_END },
+	{ '~', 200, KEY_PASTE },
+};
+
+/* Modifiers, as the second number of a sequence less one */
+enum { MOD_SHIFT = 1, MOD_ALT = 2, MOD_CTRL = 4 };
+
+static const struct {
+	int key;
+	const char *name;
+} names[] = {
+	{ KEY_UP, "KEY_UP" },
+	{ KEY_DOWN, "KEY_DOWN" },
+	{ KEY_RIGHT, "KEY_RIGHT" },
+	{ KEY_LEFT, "KEY_LEFT" },
+	{ KEY_HOME, "KEY_HOME" },
+	{ KEY_END, "KEY_END" },
+	{ KEY_BTAB, "KEY_BTAB" },
+	{ KEY_IC, "KEY_IC" },
+	{ KEY_DC, "KEY_DC" },
+	{ KEY_PPAGE, "KEY_PPAGE" },
+	{ KEY_NPAGE, "KEY_NPAGE" },
+	{ KEY_RESIZE, "KEY_RESIZE" },
+	{ KEY_C_UP, "kUP5" },
+	{ KEY_C_DOWN, "kDN5" },
+	{ KEY_C_LEFT, "kLFT5" },
+	{ KEY_C_RIGHT, "kRIT5" },
+	{ KEY_PASTE, "paste" },
+};
+
+static struct {
+	unsigned char buf[4096];  /* read, but not yet returned */
+	size_t start, end;
+	int *unget;             /* keys to return first, last one first */
+	char *fresh;            /* the key was not returned before */
+	int nunget, size;
+	int delay;              /* to wait for a key in ms, -1 forever */
+	int keypad;             /* decode escape sequences */
+	int esc_ms;             /* to wait for the rest of one */
+	char unknown[40];       /* the last sequence we didn't know */
+	int bs_erase;           /* ^H is the erase character, so Backspace */
+} in = { .delay = -1, .keypad = 1, .esc_ms = 25 };
+
+/* keys returned while recording */
+static struct {
+	int on;
+	int *keys;
+	size_t n, size;
+} rec;
+
+/* keys to return instead of reading them, count times */
+static struct {
+	const int *keys;
+	size_t n, i;
+	unsigned long count;    /* 0 for ever */
+	unsigned long played;
+} play;
+
+static volatile sig_atomic_t resized;
+static struct sigaction winch_old;
+
+static void
+on_winch(int sig)
+{
+	resized = 1;
+	/* curses wants to know too */
+	if (!(winch_old.sa_flags & SA_SIGINFO) &&
+	    winch_old.sa_handler != SIG_DFL && winch_old.sa_handler != SIG_IGN)
+		winch_old.sa_handler(sig);
+}
+
+void
+input_init(void)
+{
+	struct sigaction sa = { .sa_handler = on_winch };
+	struct termios t;
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, &winch_old);
+
+	if (tcgetattr(0, &t) == 0)
+		in.bs_erase = t.c_cc[VERASE] == BS;
+}
+
+/* Have the terminal mark pastes with \e[200~ ... \e[201~, and send
+   keys with modifiers that have no code of their own as sequences,
+   by the kitty keyboard protocol or xterm's modifyOtherKeys.  Both
+   make Escape itself a sequence where they are known. */
+void
+input_modes(int on)
+{
+	dprintf(1, on ? "\e[?2004h\e[>1u\e[>4;1m" : "\e[?2004l\e[<u\e[>4m");
+}
+
+void
+input_delay(int ms)
+{
+	in.delay = ms;
+}
+
+void
+input_keypad(int on)
+{
+	in.keypad = on;
+}
+
+static void
+unget(int ch, int fresh)
+{
+	if (in.nunget == in.size) {
+		int size = in.size ? 2 * in.size : 64;
+		int *keys = realloc(in.unget, size * sizeof *keys);
+		if (keys)
+			in.unget = keys;
+		char *f = realloc(in.fresh, size);
+		if (f)
+			in.fresh = f;
+		if (!keys || !f)
+			return;
+		in.size = size;
+	}
+	in.fresh[in.nunget] = fresh;
+	in.unget[in.nunget++] = ch;
+}
+
+void
+input_ungetch(int ch)
+{
+	unget(ch, 0);
+}
+
+/* Start recording the keys returned from now on, or stop */
+void
+input_record(int on)
+{
+	rec.on = on;
+	if (on)
+		rec.n = 0;
+}
+
+int
+input_recording(void)
+{
+	return rec.on;
+}
+
+const int *
+input_recorded(size_t *n)
+{
+	*n = rec.n;
+	return rec.keys;
+}
+
+static int
+record(int ch)
+{
+	if (!rec.on || ch == ERR || ch == KEY_RESIZE)
+		return ch;
+	if (rec.n == rec.size) {
+		size_t size = rec.size ? 2 * rec.size : 64;
+		int *keys = realloc(rec.keys, size * sizeof *keys);
+		if (!keys)
+			return ch;
+		rec.keys = keys;
+		rec.size = size;
+	}
+	rec.keys[rec.n++] = ch;
+	return ch;
+}
+
+/* Return the n keys before reading any, count times or until stopped
+   by input_replay(0, 0, 0) or a C-g typed meanwhile.  They are not
+   recorded again. */
+void
+input_replay(const int *keys, size_t n, unsigned long count)
+{
+	play.keys = keys;
+	play.n = n;
+	play.i = 0;
+	play.count = count;
+	play.played = 0;
+}
+
+int
+input_replaying(void)
+{
+	return play.n > 0;
+}
+
+static unsigned long
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/* Have a byte to read, waiting up to ms for it, or forever if ms is
+   negative.  Returns 0 if there is none, -1 if the terminal was
+   resized meanwhile. */
+static int
+fill(int ms)
+{
+	if (in.start < in.end)
+		return 1;
+	in.start = in.end = 0;
+
+	for (;;) {
+		if (resized)
+			return -1;
+		struct pollfd p = { .fd = 0, .events = POLLIN };
+		int n = poll(&p, 1, ms);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		ssize_t r = read(0, in.buf, sizeof in.buf);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return 0;
+		in.end = r;
+		return 1;
+	}
+}
+
+/* Whether C-g was typed, read without waiting.  What was typed up to
+   it is dropped, what comes after is left to read. */
+static int
+quit_typed(void)
+{
+	if (in.start > 0) {
+		memmove(in.buf, in.buf + in.start, in.end - in.start);
+		in.end -= in.start;
+		in.start = 0;
+	}
+	struct pollfd p = { .fd = 0, .events = POLLIN };
+	if (in.end < sizeof in.buf && poll(&p, 1, 0) > 0) {
+		ssize_t r = read(0, in.buf + in.end, sizeof in.buf - in.end);
+		if (r > 0)
+			in.end += r;
+	}
+
+	unsigned char *q = memchr(in.buf, QUIT, in.end);
+	if (!q)
+		return 0;
+	in.start = q + 1 - in.buf;
+	return 1;
+}
+
+/* The next byte of an escape sequence, or -1 if none comes soon.
+   When the terminal sends one in pieces, wait longer next time. */
+static int
+seq_byte(void)
+{
+	if (in.start == in.end) {
+		unsigned long t = now_ms();
+		if (fill(in.esc_ms) <= 0)
+			return -1;
+		int gap = now_ms() - t;
+		in.esc_ms = MIN(MAX(in.esc_ms, 2 * gap), ESC_MAX_MS);
+	}
+	return in.buf[in.start++];
+}
+
+/* Return the first of n keys, the others come next */
+static int
+emit(const int *k, int n)
+{
+	while (n-- > 1)
+		unget(k[n], 1);
+	return k[0];
+}
+
+/* A key as the kitty keyboard protocol or xterm's modifyOtherKeys
+   send it: its Unicode code point and modifiers */
+static int
+text_key(long code, int mods)
+{
+	int k[6], n = 0;
+
+	if (mods & MOD_ALT)
+		k[n++] = ESC;
+	if (code < 0x80) {
+		if ((mods & MOD_SHIFT) && islower(code))
+			code = toupper(code);
+		if ((mods & MOD_CTRL) && (code == ' ' || code >= '@'))
+			code = code == '?' ? 0x7f : code & 0x1f;
+		k[n++] = code;
+	} else if (code < 0x800) {
+		k[n++] = 0xc0 | code >> 6;
+		k[n++] = 0x80 | (code & 0x3f);
+	} else if (code < 0xe000 || (code >= 0xf900 && code < 0x10000)) {
+		k[n++] = 0xe0 | code >> 12;
+		k[n++] = 0x80 | (code >> 6 & 0x3f);
+		k[n++] = 0x80 | (code & 0x3f);
+	} else if (code >= 0x10000 && code < 0x110000) {
+		k[n++] = 0xf0 | code >> 18;
+		k[n++] = 0x80 | (code >> 12 & 0x3f);
+		k[n++] = 0x80 | (code >> 6 & 0x3f);
+		k[n++] = 0x80 | (code & 0x3f);
+	} else {
+		return KEY_UNKNOWN;  /* keys of the private use area */
+	}
+	return emit(k, n);
+}
+
+/* The key an escape sequence stands for.  intro is [ or O, params
+   what comes before final. */
+static int
+decode(int intro, const char *params, int final)
+{
+	long p[3] = { 0, 0, 0 };
+	int np = 0;
+
+	if (*params && strchr("<=>?", *params))
+		return KEY_UNKNOWN;
+	for (const char *s = params; *s && np < 3; np++) {
+		p[np] = strtol(s, (char **)&s, 10);
+		while (*s && *s != ';')
+			s++;  /* skip :sub-parameters */
+		if (*s == ';')
+			s++;
+	}
+	int mods = p[1] > 0 ? p[1] - 1 : 0;
+
+	if (intro == '[' && final == 'u')
+		return text_key(p[0], mods);
+	if (intro == '[' && final == '~' && p[0] == 27 && np == 3)
+		return text_key(p[2], mods);
+
+	for (size_t i = 0; i < sizeof keys / sizeof keys[0]; i++) {
+		if (keys[i].final != final)
+			continue;
+		if (final == '~' ? keys[i].number != p[0] : p[0] > 1)
+			continue;
+
+		int k[2] = { ESC, keys[i].key };
+		if (mods & MOD_CTRL) {
+			switch (k[1]) {
+			case KEY_UP:    k[1] = KEY_C_UP; break;
+			case KEY_DOWN:  k[1] = KEY_C_DOWN; break;
+			case KEY_LEFT:  k[1] = KEY_C_LEFT; break;
+			case KEY_RIGHT: k[1] = KEY_C_RIGHT; break;
+			}
+		}
+		return mods & MOD_ALT ? emit(k, 2) : k[1];
+	}
+	return KEY_UNKNOWN;
+}
+
+/* After an Escape: the key of the sequence it starts, or Escape
+   itself, with what follows it left to read */
+static int
+escape(void)
+{
+	char seq[32];
+	int n = 0, c;
+
+	if ((c = seq_byte()) < 0)
+		return ESC;
+	if (c != '[' && c != 'O') {
+		in.start--;
+		return ESC;
+	}
+	int intro = c;
+
+	/* parameters and intermediates, up to the final byte */
+	while ((c = seq_byte()) >= 0 && n < (int)sizeof seq - 1) {
+		if (intro == 'O' || (c >= 0x40 && c <= 0x7e))
+			break;
+		seq[n++] = c;
+	}
+	if (c < 0 || n == (int)sizeof seq - 1) {
+		/* not a sequence after all, give it back as keys */
+		if (c >= 0)
+			unget(c, 1);
+		while (n > 0)
+			unget((unsigned char)seq[--n], 1);
+		unget(intro, 1);
+		return ESC;
+	}
+	seq[n] = 0;
+
+	int key = decode(intro, seq, c);
+	if (key == KEY_UNKNOWN)
+		snprintf(in.unknown, sizeof in.unknown, "^[%c%s%c",
+		    intro, seq, c);
+	/* it came in one piece, maybe the terminal is fast */
+	in.esc_ms = MAX(ESC_MIN_MS, in.esc_ms - 1);
+	return key;
+}
+
+int
+input_getch(void)
+{
+	if (in.nunget > 0) {
+		in.nunget--;
+		if (in.fresh[in.nunget])
+			return record(in.unget[in.nunget]);
+		return in.unget[in.nunget];
+	}
+
+	if (play.n > 0) {
+		/* the terminal is not read meanwhile, but a C-g stops it */
+		if (++play.played % PLAY_POLL == 0 && quit_typed()) {
+			play.n = 0;
+			return QUIT;
+		}
+		int ch = play.keys[play.i++];
+		if (play.i == play.n) {
+			play.i = 0;
+			if (play.count && --play.count == 0)
+				play.n = 0;
+		}
+		return ch;
+	}
+
+	int r = fill(in.delay);
+	if (r < 0) {
+		resized = 0;
+		return KEY_RESIZE;
+	}
+	if (r == 0)
+		return ERR;
+
+	int c = in.buf[in.start++];
+	if (c == ESC && in.keypad)
+		return record(escape());
+	if (c == BS && in.keypad && in.bs_erase)
+		return record(KEY_BACKSPACE);
+	return record(c);
+}
+
+const char *
+input_keyname(int ch)
+{
+	static char buf[40];
+
+	if (ch == KEY_UNKNOWN)
+		return in.unknown;
+	for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+		if (names[i].key == ch)
+			return names[i].name;
+
+	if (ch < 0 || ch > 0xff)
+		return "?";
+	const char *meta = ch >= 0x80 ? "M-" : "";
+	ch &= 0x7f;
+	if (ch < 0x20 || ch == 0x7f)
+		snprintf(buf, sizeof buf, "%s^%c", meta, ch ^ 0x40);
+	else
+		snprintf(buf, sizeof buf, "%s%c", meta, ch);
+	return buf;
+}
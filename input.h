@@ -0,0 +1,57 @@
+/* input - te's own key reader
+
+   Keys are read from stdin and escape sequences decoded by a table,
+   as the curses key codes te knows.  A lone Escape is told from the
+   start of a sequence by waiting a few milliseconds at most, as long
+   as the terminal has been seen to need, never a fixed ESCDELAY.  ^H
+   is Backspace when the terminal has it as its erase character.
+
+   The keys returned can be recorded, and a recording replayed as if
+   it was typed, for keyboard macros. */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+/* keys curses has no codes for */
+enum {
+	KEY_C_UP = KEY_MAX + 1,
+	KEY_C_DOWN,
+	KEY_C_LEFT,
+	KEY_C_RIGHT,
+	KEY_PASTE,              /* a bracketed paste starts */
+	KEY_UNKNOWN,            /* an escape sequence we don't know */
+};
+
+void input_init(void);
+void input_modes(int on);
+int input_getch(void);
+void input_ungetch(int ch);
+void input_delay(int ms);
+void input_keypad(int on);
+const char *input_keyname(int ch);
+void input_record(int on);
+int input_recording(void);
+const int *input_recorded(size_t *n);
+void input_replay(const int *keys, size_t n, unsigned long count);
+int input_replaying(void);
+
+/* the curses calls te reads keys with go to input */
+#ifndef INPUT_IMPL
+#undef getch
+#undef ungetch
+#undef nodelay
+#undef halfdelay
+#undef nocbreak
+#undef keypad
+#undef keyname
+
+#define getch()                 input_getch()
+#define ungetch(ch)             input_ungetch(ch)
+#define nodelay(w, b)           input_delay((b) ? 0 : -1)
+#define halfdelay(t)            input_delay((t) * 100)
+#define nocbreak()              input_delay(-1)
+#define keypad(w, b)            input_keypad(b)
+#define keyname(ch)             input_keyname(ch)
+#endif
+
+#endif
@@ -1,23 +1,41 @@
 /* te - tiny emacs */
 
+#define _GNU_SOURCE  /* memmem */
+
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <locale.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <wchar.h>
 
 #include <curses.h>
 #define KEY_DEL 0177
+#ifdef TE_VT
+#include "vt.h"
+#endif
+#include "input.h"
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 
+#include "vis/array.h"
 #include "vis/text.h"
 #include "vis/text-motions.h"
 size_t text_undo_emacs(Text *txt, int n);
+size_t text_version(const Text *txt);
+size_t text_changed_since(const Text *txt, size_t version);
+void text_saved(Text *txt, struct stat *meta);
 
 #define MIN(a, b)  ((a) > (b) ? (b) : (a))
 #define MAX(a, b)  ((a) < (b) ? (b) : (a))
@@ -25,13 +43,16 @@ size_t text_undo_emacs(Text *txt, int n);
 #define ISUTF8(c)   (((c)&0xC0)!=0x80)
 #define ISASCII(ch) ((unsigned char)ch < 0x80)
 
-typedef struct {
+typedef struct Buffer {
+	struct Buffer *next;    /* selected less recently, see buffers */
 	const char *file;
 	const char *name;
-	Text *text;
+	Text *text;             /* 0 until the buffer is first shown */
 	Mark point;
 	Mark mark;
+	Mark top;               /* of the window that showed it last */
 	size_t target_column;
+	int truncate_lines;     /* instead of wrapping them */
 
 	size_t match_start;
 	size_t match_end;
@@ -49,14 +70,82 @@ typedef struct {
 } Buffer;
 
 typedef struct {
+	size_t start, end;      /* text shown in a screen row */
+	int col;                /* where the first character of it starts */
+	unsigned long hash;     /* of what it shows, 0 if unknown */
+} Row;
+
+typedef struct {
+	size_t start, next;     /* of a logical line, and of the one after */
+	int rows;               /* screen rows it wraps into */
+} LineRows;
+
+typedef struct {
+	LineRows *line;         /* consecutive lines around the view */
+	int n, size;
+	const Text *text;       /* and the text, version and layout */
+	size_t version;         /* they are valid for */
+	int cols, max;
+} LineCache;
+
+typedef struct {
+	size_t pos;             /* a row of a line starts here, or */
+	size_t n;               /* a character in that column of it */
+} Checkpoint;
+
+typedef struct {
+	const Text *text;       /* and the version and layout it is for */
+	size_t version;
+	int cols;
+	unsigned long used;
+	size_t bol;             /* of a logical line */
+	size_t lineno;          /* of that line, 0 if not known yet */
+	Checkpoint *cp;         /* every WRAP_STEP rows or COLUMN_STEP columns */
+	size_t n, size;
+	int done;               /* all rows are known, and */
+	size_t end;             /* where the line ends */
+} WrapIndex;
+
+#define WRAP_STEP 64
+#define COLUMN_STEP 4096
+#define WRAP_LINES 8
+
+typedef struct View {
+	struct View *next;      /* the window after it, see views */
 	Buffer *buf;
+	Mark point;             /* of buf, while another window is selected */
 	Mark top;
+	Mark start;             /* top, following edits in other windows */
 	size_t end;
-	int lines, cols;
+	int y, x;               /* where the window is on the screen */
+	int lines, width;       /* its size, with mode line and separator */
+	int cols;               /* and the width of its text */
+	int hscroll;            /* columns scrolled, when truncating lines */
+
+	Row *rows;              /* text rows as they are on the screen */
+	int nrows, rows_cols;   /* screen size they are for */
+	LineCache cache;
+	WrapIndex wrap[WRAP_LINES];
+	unsigned long wrap_used;
 } View;
 
-char message_buf[128];
-Text *killring;
+#define KILL_RING_MAX 120       /* entries kept at most */
+#define KILL_RING_BYTES (1UL << 30)  /* and bytes they refer to */
+
+typedef struct {
+	Text *entry[KILL_RING_MAX];  /* a ring, entry[head] killed last */
+	int head, n;
+	int yank;               /* entries before head, yanked last */
+	size_t bytes;
+} KillRing;
+
+/* per thread, for the workers of batch mode */
+_Thread_local char message_buf[128];
+_Thread_local KillRing killring;
+
+Buffer *buffers;          /* most recently selected first */
+View *views;              /* the windows, from top left to bottom right */
+int screen_lines, screen_cols;  /* they are laid out for */
 
 
 void
@@ -68,10 +157,19 @@ message(const char *fmt, ...)
 	va_end(ap);
 }
 
+/* A command could not do what it was asked to, which also ends the
+   keyboard macro running it */
 void
-alert(const char *fmt, ...)
+command_failed(void)
 {
 	flash();
+	input_replay(0, 0, 0);
+}
+
+void
+alert(const char *fmt, ...)
+{
+	command_failed();
 
 	va_list ap;
 	va_start(ap, fmt);
@@ -89,46 +187,983 @@ window_title(const char *title)
 
 }
 
+/* Latency.  The main loop times every command, the view_render after
+   it and the refresh that view_render ends with, and counts the times
+   per command in histograms of 16 buckets per power of two, in
+   microseconds.  C-x t shows a summary, and on exit the histograms go
+   to the file in $TE_LATENCY, if set. */
+
+#define HIST_BUCKETS (16 + 28 * 16)  /* up to 2^32 us */
+
+typedef struct {
+	unsigned long count, max;
+	unsigned long bucket[HIST_BUCKETS];
+} Histogram;
+
+typedef struct {
+	char keys[32];          /* of the command, as keyname shows them */
+	Histogram command, render, refresh;
+} Latency;
+
+Latency latency_all = { .keys = "all" };
+Latency *latency;
+size_t latency_n;
+unsigned long refresh_us;  /* of the last view_render */
+
+unsigned long
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static int
+hist_bucket(unsigned long us)
+{
+	if (us < 16)
+		return us;
+	if (us >= 1UL << 32)
+		return HIST_BUCKETS - 1;
+	int e = 63 - __builtin_clzl(us);
+	return 16 + (e - 4) * 16 + ((us >> (e - 4)) & 15);
+}
+
+/* the smallest time counted in bucket i */
+static unsigned long
+hist_value(int i)
+{
+	if (i < 16)
+		return i;
+	return (16UL + (i - 16) % 16) << (i - 16) / 16;
+}
+
+static void
+hist_add(Histogram *h, unsigned long us)
+{
+	h->count++;
+	h->max = MAX(h->max, us);
+	h->bucket[hist_bucket(us)]++;
+}
+
+/* the time that p percent of the counted ones take at most */
+static unsigned long
+hist_percentile(const Histogram *h, double p)
+{
+	unsigned long want = h->count * p / 100, seen = 0;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > want)
+			return MIN(hist_value(i + 1) - 1, h->max);
+	}
+	return h->max;
+}
+
+/* The latency entry for the command run by keys */
+static Latency *
+latency_get(const char *keys)
+{
+	for (size_t i = 0; i < latency_n; i++)
+		if (strcmp(latency[i].keys, keys) == 0)
+			return &latency[i];
+
+	Latency *l = realloc(latency, (latency_n + 1) * sizeof *l);
+	if (!l)
+		return 0;
+	latency = l;
+	l = &latency[latency_n++];
+	memset(l, 0, sizeof *l);
+	snprintf(l->keys, sizeof l->keys, "%s", keys);
+	return l;
+}
+
 void
-view_render(View *view)
+latency_show(void)
+{
+	const Histogram *h[] = { &latency_all.command, &latency_all.render,
+	    &latency_all.refresh };
+	unsigned long v[3][3];
+
+	for (int i = 0; i < 3; i++) {
+		v[i][0] = hist_percentile(h[i], 50);
+		v[i][1] = hist_percentile(h[i], 99);
+		v[i][2] = h[i]->max;
+	}
+	message("p50/p99/max us: command %lu/%lu/%lu render %lu/%lu/%lu "
+	    "refresh %lu/%lu/%lu (%lu keys)",
+	    v[0][0], v[0][1], v[0][2], v[1][0], v[1][1], v[1][2],
+	    v[2][0], v[2][1], v[2][2], h[0]->count);
+}
+
+static void
+latency_write_hist(FILE *f, const char *keys, const char *what,
+    const Histogram *h)
+{
+	if (!h->count)
+		return;
+	fprintf(f, "%s %s: count %lu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu\n",
+	    keys, what, h->count, hist_percentile(h, 50),
+	    hist_percentile(h, 90), hist_percentile(h, 99),
+	    hist_percentile(h, 99.9), h->max);
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		if (h->bucket[i])
+			fprintf(f, "\t%lu\t%lu\n", hist_value(i), h->bucket[i]);
+}
+
+/* Write the histograms to $TE_LATENCY, one per command and what was
+   timed, each bucket as the least time in it and its count. */
+void
+latency_dump(void)
+{
+	const char *file = getenv("TE_LATENCY");
+	if (!file || !*file)
+		return;
+
+	FILE *f = fopen(file, "w");
+	if (!f)
+		return;
+	for (size_t i = 0; i <= latency_n; i++) {
+		Latency *l = i < latency_n ? &latency[i] : &latency_all;
+		latency_write_hist(f, l->keys, "command", &l->command);
+		latency_write_hist(f, l->keys, "render", &l->render);
+		latency_write_hist(f, l->keys, "refresh", &l->refresh);
+	}
+	fclose(f);
+}
+
+/* width and length of the character at s, as view_render shows it */
+static int
+char_width(const char *s, size_t n, int col, size_t *len, mbstate_t *mbstate)
+{
+	unsigned char c = *s;
+
+	*len = 1;
+	if (c == '\t')
+		return 8 - col % 8;
+	if (c < 0x20 || c == 0x7f)
+		return 2;  /* ^X */
+	if (c < 0x80)
+		return 1;
+
+	wchar_t wchar;
+	size_t l = mbrtowc(&wchar, s, n, mbstate);
+	if (l == (size_t)-1 || l == (size_t)-2) {
+		*mbstate = (mbstate_t){ 0 };
+		return 2;  /* hex */
+	}
+	*len = l;
+	int w = wcwidth(wchar);
+	return w < 0 ? 1 : w;
+}
+
+#define HASH_INIT 14695981039346656037UL
+#define HASH(h, c) (((h) ^ (unsigned char)(c)) * 1099511628211UL)
+
+/* rows of a view, when it hasn't been drawn yet */
+static void
+view_rows_reset(View *view)
+{
+	int nrows = MAX(view->lines - 1, 1);
+
+	if (view->nrows != nrows || view->rows_cols != view->cols) {
+		free(view->rows);
+		view->rows = calloc(nrows, sizeof *view->rows);
+		view->nrows = view->rows ? nrows : 0;
+		view->rows_cols = view->cols;
+	}
+}
+
+/* If most rows moved up or down, scroll the screen instead of drawing
+   them again.  rows are the ones about to be drawn. */
+static void
+view_rows_scroll(View *view, const Row *rows)
+{
+	int n = view->nrows;
+	Row *old = view->rows;
+	int best = 0, best_same = 0;
+
+	if (view->cols < screen_cols)
+		return;  /* the terminal only scrolls whole lines */
+	for (int k = -(n - 1); k < n; k++) {
+		int same = 0;
+		for (int i = MAX(0, -k); i < n && i + k < n; i++)
+			if (rows[i].hash == old[i + k].hash)
+				same++;
+		if (same > best_same + (k != 0) * 2) {
+			best = k;
+			best_same = same;
+		}
+	}
+	if (best == 0)
+		return;
+
+	setscrreg(view->y, view->y + n - 1);
+	scrollok(stdscr, TRUE);
+	wscrl(stdscr, best);
+	scrollok(stdscr, FALSE);
+	setscrreg(0, screen_lines - 1);
+
+	if (best > 0) {
+		memmove(old, old + best, (n - best) * sizeof *old);
+		memset(old + n - best, 0, best * sizeof *old);
+	} else {
+		memmove(old - best, old, (n + best) * sizeof *old);
+		memset(old, 0, -best * sizeof *old);
+	}
+}
+
+/* Screen layout.  layout_row breaks the text into rows the way
+   view_render draws them, and the line cache of a view remembers how
+   many rows the logical lines around it wrap into, so the top and end
+   of a view are known exactly without drawing it.  When a buffer
+   truncates lines, every logical line is one row, scrolled sideways
+   by view->hscroll columns. */
+
+enum { ROW_NEWLINE, ROW_WRAP, ROW_END, ROW_STOP };
+
+#define LINE_CACHE 512
+
+/* Lay out the screen row starting at pos in column col, up to the
+   character at stop or the first one reaching past column stop_col.
+   Returns where that is: after the newline, at the character that
+   didn't fit or at the end of text when the row is complete.  *how
+   tells which, *endcol is the column reached. */
+static size_t
+layout_scan(Text *txt, size_t pos, int col, int cols, size_t stop,
+    int stop_col, int *how, int *endcol)
+{
+	char buf[256];
+	size_t len = 0, i = 0, clen;
+	mbstate_t mbstate = { 0 };
+
+	for (;; i += clen) {
+		if (i >= len || (len == sizeof buf && len - i < 4)) {
+			/* refill, keeping characters in one piece */
+			pos += i;
+			i = 0;
+			len = text_bytes_get(txt, pos, sizeof buf, buf);
+			if (len == 0) {
+				*how = ROW_END;
+				break;
+			}
+		}
+		if (pos + i >= stop) {
+			*how = ROW_STOP;
+			break;
+		}
+		if (buf[i] == '\n') {
+			*how = ROW_NEWLINE;
+			i++;
+			break;
+		}
+
+		int w = char_width(buf + i, len - i, col, &clen, &mbstate);
+		if (buf[i] == '\t' && col < cols - 1) {
+			w = MIN(w, cols - 1 - col);
+		} else if (col + w > cols - 1 && col > 0) {
+			*how = ROW_WRAP;
+			break;
+		}
+		if (col + w > stop_col) {
+			*how = ROW_STOP;
+			break;
+		}
+		col += w;
+	}
+	*endcol = col;
+	return pos + i;
+}
+
+/* Columns rows are laid out in, 0 if lines are truncated */
+static int
+layout_cols(View *view)
+{
+	return view->buf->truncate_lines ? 0 : view->cols;
+}
+
+static size_t
+layout_row(View *view, size_t pos, int *how)
+{
+	Text *txt = view->buf->text;
+	int col;
+
+	if (view->buf->truncate_lines) {
+		size_t end = text_line_end(txt, pos);
+		*how = end < text_size(txt) ? ROW_NEWLINE : ROW_END;
+		return *how == ROW_NEWLINE ? end + 1 : end;
+	}
+	return layout_scan(txt, pos, 0, view->cols, EPOS, INT_MAX, how, &col);
+}
+
+/* Screen rows the logical line at bol wraps into, at most one more
+   than the view has; *next is set to where the next line starts. */
+static int
+view_line_rows(View *view, size_t bol, size_t *next)
+{
+	LineCache *c = &view->cache;
+	Text *txt = view->buf->text;
+	int lo = 0, hi = c->n;
+
+	if (c->text != txt || c->version != text_version(txt) ||
+	    c->cols != layout_cols(view) || c->max != view->nrows + 1) {
+		c->text = txt;
+		c->version = text_version(txt);
+		c->cols = layout_cols(view);
+		c->max = view->nrows + 1;
+		c->n = hi = 0;
+	}
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (c->line[mid].start < bol)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < c->n && c->line[lo].start == bol) {
+		*next = c->line[lo].next;
+		return c->line[lo].rows;
+	}
+
+	LineRows l = { bol, bol, 0 };
+	int how = ROW_WRAP;
+	while (how == ROW_WRAP && l.rows < c->max) {
+		l.next = layout_row(view, l.next, &how);
+		l.rows++;
+	}
+	if (how == ROW_WRAP)
+		l.next = text_line_next(txt, l.next);
+	*next = l.next;
+
+	if (!c->line) {
+		c->line = malloc(LINE_CACHE * sizeof *c->line);
+		if (!c->line)
+			return l.rows;
+		c->size = LINE_CACHE;
+	}
+
+	/* only keep lines next to each other, dropping the far end */
+	if (c->n > 0 && !(lo == 0 && l.next == c->line[0].start) &&
+	    !(lo == c->n && c->line[c->n - 1].next == bol))
+		c->n = lo = 0;
+	if (c->n == c->size) {
+		if (lo == 0) {
+			c->n--;
+		} else {
+			memmove(c->line, c->line + 1, --c->n * sizeof *c->line);
+			lo--;
+		}
+	}
+	memmove(c->line + lo + 1, c->line + lo, (c->n - lo) * sizeof *c->line);
+	c->line[lo] = l;
+	c->n++;
+
+	return l.rows;
+}
+
+/* Rows of long lines.  A wrap index remembers where every WRAP_STEP-th
+   row of a logical line starts, so that the rows around a position
+   deep into a line of many megabytes are found without laying out the
+   line from its beginning.  Indexes are extended as far as they are
+   needed, and cut back to the first change when the text is edited.
+   With truncated lines, they remember the character about every
+   COLUMN_STEP columns instead. */
+
+/* w, made valid for the text as it is now, or emptied */
+static WrapIndex *
+wrap_repair(View *view, WrapIndex *w)
+{
+	Text *txt = view->buf->text;
+
+	if (w->text != txt || w->cols != layout_cols(view)) {
+		w->n = 0;
+		return w;
+	}
+	if (w->version != text_version(txt)) {
+		size_t changed = text_changed_since(txt, w->version);
+		if (changed < w->bol) {
+			w->n = 0;
+			return w;
+		}
+		/* a change can widen the character before it */
+		while (w->n > 1 && w->cp[w->n - 1].pos + 4 > changed)
+			w->n--;
+		w->done = 0;
+		w->version = text_version(txt);
+	}
+	return w;
+}
+
+/* The wrap index of the line at bol */
+static WrapIndex *
+wrap_index(View *view, size_t bol)
+{
+	Text *txt = view->buf->text;
+	WrapIndex *w, *lru = view->wrap;
+
+	for (w = view->wrap; w < view->wrap + WRAP_LINES; w++) {
+		if (wrap_repair(view, w)->n > 0 && w->bol == bol)
+			goto found;
+		if (lru->n > 0 && (w->n == 0 || w->used < lru->used))
+			lru = w;
+	}
+
+	w = lru;
+	if (!w->cp) {
+		w->cp = malloc(16 * sizeof *w->cp);
+		if (!w->cp)
+			return 0;
+		w->size = 16;
+	}
+	w->text = txt;
+	w->version = text_version(txt);
+	w->cols = layout_cols(view);
+	w->bol = bol;
+	w->lineno = 0;
+	w->cp[0] = (Checkpoint){ bol, 0 };
+	w->n = 1;
+	w->done = 0;
+found:
+	w->used = ++view->wrap_used;
+	return w;
+}
+
+/* The wrap index of a line known to contain pos, if there is one */
+static WrapIndex *
+wrap_find(View *view, size_t pos)
+{
+	for (WrapIndex *w = view->wrap; w < view->wrap + WRAP_LINES; w++) {
+		if (wrap_repair(view, w)->n > 0 && w->bol <= pos &&
+		    (w->done ? pos <= w->end : pos <= w->cp[w->n - 1].pos)) {
+			w->used = ++view->wrap_used;
+			return w;
+		}
+	}
+	return 0;
+}
+
+/* Add the next checkpoint to w, or find that its line ends before it */
+static int
+wrap_extend(View *view, WrapIndex *w)
+{
+	Text *txt = view->buf->text;
+	Checkpoint last = w->cp[w->n - 1];
+	size_t pos = last.pos;
+	int how = ROW_WRAP, col;
+
+	if (w->done)
+		return 0;
+	if (view->buf->truncate_lines) {
+		pos = layout_scan(txt, pos, last.n, INT_MAX, EPOS,
+		    last.n + COLUMN_STEP, &how, &col);
+		if (how == ROW_STOP)
+			last = (Checkpoint){ pos, col };
+	} else {
+		for (int i = 0; i < WRAP_STEP && how == ROW_WRAP; i++)
+			pos = layout_row(view, pos, &how);
+		last = (Checkpoint){ pos, last.n + WRAP_STEP };
+	}
+	if (how == ROW_NEWLINE || how == ROW_END) {
+		w->done = 1;
+		w->end = how == ROW_NEWLINE ? pos - 1 : pos;
+		return 0;
+	}
+
+	if (w->n == w->size) {
+		Checkpoint *cp = realloc(w->cp, 2 * w->size * sizeof *cp);
+		if (!cp)
+			return 0;
+		w->cp = cp;
+		w->size *= 2;
+	}
+	w->cp[w->n++] = last;
+	return 1;
+}
+
+/* The checkpoint of the truncated line at bol that is last before pos
+   and column col */
+static Checkpoint
+column_checkpoint(View *view, size_t bol, size_t pos, size_t col)
+{
+	WrapIndex *w = wrap_index(view, bol);
+
+	if (!w)
+		return (Checkpoint){ bol, 0 };
+	while (w->cp[w->n - 1].pos <= pos && w->cp[w->n - 1].n <= col &&
+	    wrap_extend(view, w))
+		;
+	size_t lo = 0, hi = w->n;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (w->cp[mid].pos <= pos && w->cp[mid].n <= col)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return w->cp[lo];
+}
+
+/* Where the row of the view showing pos starts.  *bol is set to the
+   start of its logical line, and *row to its number in that line. */
+static size_t
+view_row(View *view, size_t pos, size_t *bol, size_t *row)
+{
+	Text *txt = view->buf->text;
+	WrapIndex *w = wrap_find(view, pos);
+	int how;
+
+	if (view->buf->truncate_lines) {
+		*bol = w ? w->bol : text_line_begin(txt, pos);
+		*row = 0;
+		return *bol;
+	}
+	if (!w)
+		w = wrap_index(view, text_line_begin(txt, pos));
+	if (!w) {
+		/* no memory, but laying out from the start of line works */
+		size_t start = *bol = text_line_begin(txt, pos);
+		for (*row = 0; ; ++*row) {
+			size_t next = layout_row(view, start, &how);
+			if (pos < next || how != ROW_WRAP)
+				return start;
+			start = next;
+		}
+	}
+
+	while (w->cp[w->n - 1].pos <= pos && wrap_extend(view, w))
+		;
+	size_t lo = 0, hi = w->n;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (w->cp[mid].pos <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	size_t start = w->cp[lo].pos;
+	*bol = w->bol;
+	*row = w->cp[lo].n;
+	for (;;) {
+		size_t next = layout_row(view, start, &how);
+		if (pos < next || how != ROW_WRAP)
+			return start;
+		start = next;
+		++*row;
+	}
+}
+
+/* Where the row number *row of the logical line at bol starts, or its
+   last row if it has fewer.  *row is set to the row it is. */
+static size_t
+view_row_nth(View *view, size_t bol, size_t *row)
+{
+	WrapIndex *w;
+	size_t start = bol, n = 0;
+	int how;
+
+	if (view->buf->truncate_lines) {
+		*row = 0;
+		return bol;
+	}
+	if ((w = wrap_index(view, bol))) {
+		while (w->n - 1 < *row / WRAP_STEP && wrap_extend(view, w))
+			;
+		n = MIN(*row / WRAP_STEP, w->n - 1);
+		start = w->cp[n].pos;
+		n = w->cp[n].n;
+	}
+	for (; n < *row; n++) {
+		size_t next = layout_row(view, start, &how);
+		if (how != ROW_WRAP)
+			break;
+		start = next;
+	}
+	*row = n;
+	return start;
+}
+
+/* The line number of the logical line at bol */
+static size_t
+view_lineno(View *view, size_t bol)
+{
+	WrapIndex *w = wrap_index(view, bol);
+
+	if (!w)
+		return text_lineno_by_pos(view->buf->text, bol);
+	if (!w->lineno)
+		w->lineno = text_lineno_by_pos(view->buf->text, bol);
+	return w->lineno;
+}
+
+/* Where the row n rows after the one showing pos starts, or before it
+   if n is negative, going no further than the text does.  *moved is
+   set to how many rows that is.  Moves of more than a screen leave
+   the rows of the lines in between uncounted: past the line of pos
+   they go by line number, a line a row. */
+static size_t
+view_rows_move(View *view, size_t pos, long n, long *moved)
+{
+	Text *txt = view->buf->text;
+	size_t size = text_size(txt);
+	size_t bol, row;
+	size_t start = view_row(view, pos, &bol, &row);
+	int how;
+
+	*moved = 0;
+	if (n != 0 && (view->buf->truncate_lines || labs(n) > view->lines)) {
+		/* rows left in this line, when truncated none */
+		size_t last = SIZE_MAX;
+		size_t left = row;
+		if (n > 0) {
+			view_row_nth(view, bol, &last);
+			left = last - row;
+		}
+		if ((size_t)labs(n) <= left) {
+			row += n;
+			*moved = labs(n);
+			return view_row_nth(view, bol, &row);
+		}
+
+		/* then go to the line at once */
+		size_t line = view_lineno(view, bol);
+		size_t lines = labs(n) - left;
+		size_t to;
+		if (n > 0) {
+			to = text_pos_by_lineno(txt, line + lines);
+			/* the empty line after a final newline is not one */
+			if (to == EPOS || (to == size && size > 0))
+				to = MAX(bol, text_line_begin(txt, size - 1));
+		} else {
+			to = text_pos_by_lineno(txt, line > lines ? line - lines : 1);
+		}
+		size_t crossed = labs((long)(text_lineno_by_pos(txt, to) - line));
+		*moved = left + crossed;
+		if (crossed == 0) {
+			row = n > 0 ? last : 0;
+			return view_row_nth(view, bol, &row);
+		}
+		if (n < 0) {
+			/* coming from below, into its last row */
+			row = SIZE_MAX;
+			return view_row_nth(view, to, &row);
+		}
+		return to;
+	}
+	while (n > *moved) {
+		/* the empty line after a final newline is not a row to go to */
+		size_t next = layout_row(view, start, &how);
+		if (how == ROW_END || next == size)
+			break;
+		start = next;
+		++*moved;
+	}
+	while (n < -*moved) {
+		size_t left = -n - *moved;
+		if (row >= left) {
+			row -= left;
+			*moved += left;
+			return view_row_nth(view, bol, &row);
+		}
+		*moved += row;
+		start = bol;
+		if (bol == 0)
+			break;
+		start = view_row(view, bol - 1, &bol, &row);
+		++*moved;
+	}
+	return start;
+}
+
+/* Screen rows from the one starting at from to the one showing pos,
+   at most max. */
+static int
+view_rows_to(View *view, size_t from, size_t pos, int max)
+{
+	size_t bol, row, from_bol, from_row;
+	int rows = 0, how;
+
+	view_row(view, pos, &bol, &row);
+	view_row(view, from, &from_bol, &from_row);
+	if (from_bol == bol)
+		return MIN(row - from_row, (size_t)max);
+
+	if (from != from_bol) {
+		/* the rest of the line from is in */
+		do {
+			from = layout_row(view, from, &how);
+			rows++;
+		} while (how == ROW_WRAP && rows < max);
+	}
+	while (from < bol && rows < max) {
+		size_t next;
+		rows += view_line_rows(view, from, &next);
+		from = next;
+	}
+	return MIN(rows + row, (size_t)max);
+}
+
+/* Column of pos in its screen row, or its logical line if lines are
+   truncated */
+static int
+view_column(View *view, size_t pos)
+{
+	size_t bol, row;
+	size_t start = view_row(view, pos, &bol, &row);
+	int how, col;
+
+	if (view->buf->truncate_lines) {
+		Checkpoint cp = column_checkpoint(view, bol, pos, INT_MAX);
+		layout_scan(view->buf->text, cp.pos, cp.n, INT_MAX, pos,
+		    INT_MAX, &how, &col);
+		return col;
+	}
+	layout_scan(view->buf->text, start, 0, view->cols, pos, INT_MAX,
+	    &how, &col);
+	return col;
+}
+
+/* Position of the character in the row starting at start that covers
+   column col, or of the last one if the row is shorter. */
+static size_t
+view_column_set(View *view, size_t start, int col)
+{
+	Text *txt = view->buf->text;
+	int how, endcol;
+	size_t pos;
+
+	if (view->buf->truncate_lines) {
+		Checkpoint cp = column_checkpoint(view, start, EPOS, col);
+		pos = layout_scan(txt, cp.pos, cp.n, INT_MAX, EPOS, col,
+		    &how, &endcol);
+	} else {
+		pos = layout_scan(txt, start, 0, view->cols, EPOS, col,
+		    &how, &endcol);
+	}
+
+	if (how == ROW_NEWLINE)
+		return pos - 1;
+	if (how == ROW_WRAP)
+		return text_char_prev(txt, pos);
+	return pos;
+}
+
+/* Where the view has to start to show point.  That is view->top, moved
+   down in steps of 10 rows if point is below the screen, or the top
+   that shows point in the last row if point is far below.  When point
+   is above the screen, its row becomes the top. */
+static size_t
+view_top(View *view, size_t point)
+{
+	int nrows = view->nrows;
+	size_t bol, row;
+	size_t start = view_row(view, point, &bol, &row);
+	size_t top = view_row(view, MIN(view->top, text_size(view->buf->text)),
+	    &bol, &row);
+	long moved;
+
+	if (point < top)
+		return start;
+
+	int rows = view_rows_to(view, top, point, 2 * nrows);
+	if (rows < nrows)
+		return top;
+	if (rows < 2 * nrows && (rows - nrows + 10) / 10 * 10 <= rows)
+		return view_rows_move(view, top, (rows - nrows + 10) / 10 * 10,
+		    &moved);
+	return view_rows_move(view, start, -(nrows - 1), &moved);
+}
+
+enum { EDGE_RIGHT = 1, EDGE_LEFT = 2 };  /* more text is off screen */
+
+/* Lay out the part of the truncated line at bol that shows in view as
+   r, and set *edge to where it has more.  Returns where the next line
+   starts, *how tells if the line ends in a newline. */
+static size_t
+view_truncated_row(View *view, size_t bol, Row *r, char *edge, int *how)
+{
+	Text *txt = view->buf->text;
+	int hscroll = view->hscroll;
+	size_t pos;
+	int col;
+
+	/* the character covering the first column, maybe partly */
+	r->start = bol;
+	r->col = 0;
+	*how = ROW_STOP;
+	if (hscroll > 0) {
+		Checkpoint cp = column_checkpoint(view, bol, EPOS, hscroll);
+		r->start = layout_scan(txt, cp.pos, cp.n, INT_MAX, EPOS,
+		    hscroll, how, &r->col);
+	}
+	if (*how != ROW_STOP) {
+		/* the line is too short to show */
+		pos = r->start;
+		if (*how == ROW_NEWLINE)
+			r->start--;
+		r->end = r->start;
+		*edge = r->start > bol ? EDGE_LEFT : 0;
+		return pos;
+	}
+	*edge = r->start > bol ? EDGE_LEFT : 0;
+
+	pos = r->end = layout_scan(txt, r->start, r->col, INT_MAX, EPOS,
+	    hscroll + view->cols - 1, how, &col);
+	if (*how == ROW_STOP) {
+		*edge |= EDGE_RIGHT;
+		pos = layout_row(view, pos, how);
+	}
+	return pos;
+}
+
+/* Lay out the rows of view from top.  Fills rows and edge, sets
+   *text_rows to how many show text and returns where that text ends. */
+static size_t
+view_layout(View *view, size_t top, Row *rows, char *edge, int *text_rows)
+{
+	Text *txt = view->buf->text;
+	size_t size = text_size(txt);
+	size_t pos = top;
+	int row = 0, how = ROW_END;
+
+	while (row < view->nrows) {
+		if (view->buf->truncate_lines) {
+			pos = view_truncated_row(view, pos, &rows[row],
+			    &edge[row], &how);
+		} else {
+			rows[row].start = pos;
+			rows[row].col = 0;
+			pos = layout_row(view, pos, &how);
+			rows[row].end = pos;
+			edge[row] = how == ROW_WRAP ? EDGE_RIGHT : 0;
+		}
+		row++;
+		if (how == ROW_END || (how == ROW_NEWLINE && pos == size))
+			break;
+	}
+	*text_rows = row;
+	for (; row < view->nrows; row++) {
+		rows[row].start = rows[row].end = pos;
+		rows[row].col = 0;
+		edge[row] = 0;
+	}
+
+	/* the newline of the last row doesn't count if more text follows */
+	if (how == ROW_NEWLINE && pos < size)
+		pos--;
+	return pos;
+}
+
+/* Clear n columns from the cursor on, leaving it where it is */
+static void
+clear_cols(int n)
+{
+	int y, x;
+
+	getyx(stdscr, y, x);
+	if (x + n >= screen_cols) {
+		clrtoeol();
+		return;
+	}
+	while (n-- > 0)
+		addch(' ');
+	move(y, x);
+}
+
+/* Draw the rows of a window that changed, and its mode line.  Only the
+   selected window shows the point of its buffer, and the cursor, which
+   goes to *cur_y, *cur_x. */
+static void
+view_draw(View *view, int selected, int *cur_y, int *cur_x)
 {
 	Buffer *buf = view->buf;
+	Mark *mark = selected ? &buf->point : &view->point;
 
-	int lines = view->lines;
 	int cols = view->cols;
 
-missed:
-	erase();
-	move(0, 0);
+	view_rows_reset(view);
+	int nrows = view->nrows;
+	Row rows[nrows];
+	char edge[nrows];
 
-	size_t point = text_mark_get(buf->text, buf->point);
-	size_t lineno = text_lineno_by_pos(buf->text, point);
-	size_t bol_point = text_pos_by_lineno(buf->text, lineno);
-
-	char buffer[lines*cols*4 + 8];
-	size_t top = view->top;
+	size_t point = text_mark_get(buf->text, *mark);
 
 	if (point == EPOS) {
 		/* we somehow lost track of point, let's keep it visible */
-		message("Huh.");
-		point = top;
-		buf->point = text_mark_set(buf->text, point);
+		if (selected)
+			message("Huh.");
+		point = MIN(view->top, text_size(buf->text));
+		*mark = text_mark_set(buf->text, point);
+	}
+	if (!selected) {
+		size_t start = text_mark_get(buf->text, view->start);
+		if (start != EPOS)
+			view->top = start;
+	}
+
+	size_t bol_point, point_row;
+	view_row(view, point, &bol_point, &point_row);
+	size_t lineno = view_lineno(view, bol_point);
+
+	/* scroll sideways so point is neither under a $ nor past the last
+	   column that has room for it */
+	int point_col = view_column(view, point);
+	if (!buf->truncate_lines) {
+		view->hscroll = 0;
+	} else if (point_col < view->hscroll + (view->hscroll > 0) ||
+	    point_col >= view->hscroll + cols - 2) {
+		view->hscroll = point_col < cols - 2 ? 0 : point_col - cols / 2;
 	}
 
-	if ((int)(point - bol_point) > (lines-3)*(cols-1)) {
-		top = point - (lines-3)*(cols-1);
-		attron(A_REVERSE);
-		addstr("...");
-		attroff(A_REVERSE);
+	size_t top = view->top = view_top(view, point);
+	view->start = text_mark_set(buf->text, top);
+
+	int text_rows;
+	view->end = view_layout(view, top, rows, edge, &text_rows);
+
+	/* at the end of the file, a lozenge marks a missing final newline,
+	   the empty line after a final newline only shows if point is there */
+	int eof_mark = -1;
+	if (point == text_size(buf->text)) {
+		char c = 0;
+		if (point > 0)
+			text_byte_get(buf->text, point - 1, &c);
+		if (c != '\n')
+			eof_mark = text_rows - 1;
+		else if (rows[text_rows - 1].start != point && text_rows < nrows)
+			text_rows++;
 	}
 
-	size_t len = text_bytes_get(buf->text, top, sizeof buffer - 1, buffer);
+	/* the cursor goes where point is in its row */
+	int row;
+	for (row = 0; row < text_rows - 1 && point >= rows[row].end; row++)
+		;
+	*cur_y = view->y + row;
+	*cur_x = view->x + point_col - view->hscroll;
+
+	/* from now on, rows are in buffer offsets, and base[row] + i is
+	   the text position of buffer[i] */
+	char buffer[nrows*cols*4 + 8];
+	size_t base[nrows];
+	size_t len = 0;
+	for (row = 0; row < nrows; row++) {
+		size_t n = MIN(rows[row].end - rows[row].start,
+		    sizeof buffer - 1 - len);
+		n = text_bytes_get(buf->text, rows[row].start, n, buffer + len);
+		base[row] = rows[row].start - len;
+		rows[row].start = len;
+		rows[row].end = len += n;
+	}
 	buffer[len] = 0;
 
 	/* This is a bit more complicated than in vi, because emacs
 	   higlights closing brackets when the cursor is after them,
 	   but opening ones when the cursor is on them. */
-	Filerange limits = { view->top, view->top + len };
+	Filerange limits = { top, top + sizeof buffer - 1 };
+	if (buf->truncate_lines)  /* only near point, the rest is hidden */
+		limits = (Filerange){ MAX(top, point - MIN(point, sizeof buffer / 2)),
+		    point + sizeof buffer / 2 };
 	int highlight_brackets;
 	size_t highlight_point;
 	size_t pos_match = text_bracket_match_symbol(buf->text,
@@ -142,176 +1177,414 @@ missed:
 		highlight_brackets = pos_match > point;   /* closing? */
 		highlight_point = point;
 	}
+	if (!selected)
+		highlight_brackets = 0;
 
-	int line = 0;
-	int col = 0;
-	int cur_y = lines, cur_x = cols;
-	size_t i;
+	size_t i, clen;
 	mbstate_t mbstate = { 0 };
+	int col;
 
-	if (buf->match_end && buf->match_start < top)
-		attron(A_BOLD);
+	/* hash what every row shows, to only draw the ones that changed */
+	for (row = 0; row < nrows; row++) {
+		unsigned long h = HASH_INIT;
 
-	for (i = 0; i < len; i++) {
-		int on_point = i == point - top;
-		if (on_point)
-			getyx(stdscr, cur_y, cur_x);
-		int on_highlight_point = i == highlight_point - top;
+		if (row >= text_rows) {
+			rows[row].start = rows[row].end = len;
+			rows[row].hash = HASH(h, '~');
+			continue;
+		}
+		h = HASH(h, edge[row] | buf->truncate_lines << 2);
+		h = HASH(h, row == eof_mark);
+		h = HASH(h, rows[row].col - view->hscroll);
+		for (i = rows[row].start; i < rows[row].end; i++) {
+			size_t pos = base[row] + i;
+			int bold = buf->match_end &&
+			    buf->match_start <= pos && pos < buf->match_end;
+			if (highlight_brackets &&
+			    (pos == highlight_point || pos == pos_match))
+				bold = 1;
+			h = HASH(HASH(h, buffer[i]), bold);
+		}
+		rows[row].hash = h ? h : 1;
+	}
 
-		if (i == buf->match_start - top)
-			attron(A_BOLD);
-		if (i == buf->match_end - top)
-			attroff(A_BOLD);
+	view_rows_scroll(view, rows);
+
+	for (row = 0; row < nrows; row++) {
+		Row *r = &rows[row];
+		if (r->hash == view->rows[row].hash)
+			continue;
+		view->rows[row] = (Row){ base[row] + r->start,
+		    base[row] + r->end, r->col, r->hash };
+
+		move(view->y + row, view->x);
+		clear_cols(cols);
+		if (view->x + cols < screen_cols)
+			mvaddch(view->y + row, view->x + cols, '|');
+		move(view->y + row, view->x);
+		if (row >= text_rows) {
+			addch('~');
+			continue;
+		}
 
-		if (highlight_brackets)
-			if (on_highlight_point || i == pos_match - top)
+		mbstate = (mbstate_t){ 0 };
+		col = r->col;
+		for (i = r->start; i < r->end; i += clen) {
+			size_t pos = base[row] + i;
+			int bold = buf->match_end &&
+			    buf->match_start <= pos && pos < buf->match_end;
+			if (highlight_brackets &&
+			    (pos == highlight_point || pos == pos_match))
+				bold = 1;
+			if (bold)
 				attron(A_BOLD);
 
-		if (buffer[i] == '\n') {
-			getyx(stdscr, line, col);
-			move(line + 1, 0);
-			if (line == lines - 3)
-				break;
-		} else {
-			getyx(stdscr, line, col);
-			if (col == cols - 1) {
-				addch('\\');
-				move(line + 1, 0);
-				if (on_point)
-					getyx(stdscr, cur_y, cur_x);
-				if (line == lines - 3)
-					break;
-			}
-
-			if ((unsigned char)buffer[i] >= 0x80) {
-				/* detect invalid UTF-8 */
-				wchar_t wchar;
-				size_t len = mbrtowc(&wchar, buffer+i, 8, &mbstate);
-				if (len == (size_t)-1 && errno == EILSEQ) {
-					mbstate = (mbstate_t){ 0 };
-					attron(A_REVERSE);
-					printw("%02x", (unsigned char)buffer[i]);
-					attroff(A_REVERSE);
-					continue;
-				} else if (len == (size_t)-2) {
-					/* I think -2 can't happen here? */
-					abort();
-				}
-
-				/* UTF-8 is valid, print at once */
-				addnstr(buffer+i, len);
-				i += len - 1;
-			} else if (buffer[i] != '\t' && 0x00 <= buffer[i] && buffer[i] < 0x20) {
+			unsigned char c = buffer[i];
+			int w = char_width(buffer + i, r->end - i, col, &clen,
+			    &mbstate);
+			int x = col - view->hscroll;
+			if (c == '\n') {
+				;
+			} else if (x < 0) {
+				/* partly scrolled off to the left */
+				for (int n = x + w; n > 0; n--)
+					addch(' ');
+			} else if (c == '\t') {
+				for (w = MIN(w, cols - 1 - x); w > 0; w--, col++)
+					addch(' ');
+			} else if (c < 0x20) {
 				attron(A_BOLD);
 				addch('^');
-				addch('@' + buffer[i]);
+				addch('@' + c);
 				attroff(A_BOLD);
-			} else if (buffer[i] == 0x7f) {
+			} else if (c == 0x7f) {
 				attron(A_BOLD);
 				addch('^');
 				addch('?');
 				attroff(A_BOLD);
+			} else if (c >= 0x80 && clen == 1) {
+				/* invalid UTF-8 */
+				attron(A_REVERSE);
+				printw("%02x", c);
+				attroff(A_REVERSE);
 			} else {
-				addch((unsigned char)buffer[i]);
+				addnstr(buffer + i, clen);
 			}
+			col += w;
+
+			if (bold)
+				attroff(A_BOLD);
 		}
 
-		if (highlight_brackets)
-			if (on_highlight_point || i == pos_match - top)
-				attroff(A_BOLD);
+		if (row == eof_mark)
+			addstr("\xE2\x97\x8A");  // U+25CA LOZENGE
+		if (edge[row] & EDGE_RIGHT)
+			mvaddch(view->y + row, view->x + cols - 1,
+			    buf->truncate_lines ? '$' : '\\');
+		if (edge[row] & EDGE_LEFT)
+			mvaddch(view->y + row, view->x, '$');
+	}
+
+	char mode[256];
+	snprintf(mode, sizeof mode, "--%s- %s -- L%ld C%ld B%ld/%ld",
+	    text_modified(buf->text) ? "**" : "--",
+	    buf->name,
+	    lineno,
+	    point - bol_point + 1,
+	    point,
+	    text_size(buf->text)
+	);
+	move(view->y + view->lines - 1, view->x);
+	clear_cols(view->width);
+	addnstr(mode, view->width);
+	mvchgat(view->y + view->lines - 1, view->x, view->width, A_REVERSE, 0, 0);
+}
+
+/* Draw all windows, view being the selected one, and the echo area */
+void
+view_render(View *view)
+{
+	int cur_y = 0, cur_x = 0, y, x;
+
+	if (input_replaying())
+		return;
+
+	for (View *v = views; v; v = v->next)
+		if (v != view)
+			view_draw(v, 0, &y, &x);
+	view_draw(view, 1, &cur_y, &cur_x);
+
+	move(screen_lines - 1, 0);
+	clrtoeol();
+	printw("%s", message_buf);
+
+	move(cur_y, cur_x);
+
+	unsigned long t = now_us();
+	refresh();
+	refresh_us = now_us() - t;
+}
+
+static void
+update_target_column(Buffer *buf)
+{
+	buf->target_column = EPOS;  /* where point is, see move_line */
+}
+
+void
+recenter(View *view)
+{
+	Buffer *buf = view->buf;
+
+	size_t point = text_mark_get(buf->text, buf->point);
+	long moved;
+
+	view->top = view_rows_move(view, point, -(view->lines-1)/2, &moved);
+
+	buf->last_action = ACTION_OTHER;
+}
+
+void
+toggle_truncate_lines(View *view)
+{
+	Buffer *buf = view->buf;
+
+	buf->truncate_lines = !buf->truncate_lines;
+	message("Truncate long lines %s",
+	    buf->truncate_lines ? "enabled" : "disabled");
+
+	/* the rows are different now, start them around point */
+	view->hscroll = 0;
+	update_target_column(buf);
+	recenter(view);
+}
+
+/* Windows.  The screen above the echo area is cut into windows the
+   way a guillotine cuts paper: each split cuts one window in two, so
+   any window has a side that others fill exactly.  A window left of
+   another ends in a column of |.  Every window has its own top, point
+   and layout caches, the point of the selected window is the one of
+   its buffer. */
+
+#define WINDOW_MIN_LINES 2
+#define WINDOW_MIN_COLS 8
+
+/* Put view at y, x, to be drawn anew there */
+static void
+view_place(View *view, int y, int x, int lines, int width)
+{
+	view->y = y;
+	view->x = x;
+	view->lines = lines;
+	view->width = width;
+	view->cols = x + width < screen_cols ? width - 1 : width;
+	free(view->rows);
+	view->rows = 0;
+	view->nrows = 0;
+}
+
+static void
+view_free(View *view)
+{
+	free(view->rows);
+	free(view->cache.line);
+	for (int i = 0; i < WRAP_LINES; i++)
+		free(view->wrap[i].cp);
+	free(view);
+}
+
+/* Select window to instead of from, which is gone if 0 */
+static View *
+view_select(View *from, View *to)
+{
+	if (from) {
+		from->point = from->buf->point;
+		from->start = text_mark_set(from->buf->text, from->top);
+	}
+	to->buf->point = to->point;
+	update_target_column(to->buf);
+	to->buf->last_action = ACTION_OTHER;
+	return to;
+}
+
+/* Split view into two showing the same, one above the other or side by
+   side.  view stays selected. */
+void
+split_window(View *view, int side_by_side)
+{
+	int lines = view->lines, width = view->width;
+
+	if (side_by_side ? width < 2 * WINDOW_MIN_COLS :
+	    lines < 2 * WINDOW_MIN_LINES) {
+		alert("Window too small for splitting");
+		return;
+	}
+	View *new = calloc(1, sizeof *new);
+	if (!new)
+		return;
+
+	new->buf = view->buf;
+	new->point = view->buf->point;
+	new->top = view->top;
+	new->hscroll = view->hscroll;
+	if (side_by_side) {
+		view_place(new, view->y, view->x + (width + 1) / 2,
+		    lines, width / 2);
+		view_place(view, view->y, view->x, lines, (width + 1) / 2);
+	} else {
+		view_place(new, view->y + (lines + 1) / 2, view->x,
+		    lines / 2, width);
+		view_place(view, view->y, view->x, (lines + 1) / 2, width);
 	}
-	view->end = top + i;
+	new->next = view->next;
+	view->next = new;
 
-	attroff(A_BOLD);
+	view->buf->last_action = ACTION_OTHER;
+}
 
-	if (point > view->end) {
-		/* When lots of line wrapping happened, we may not have reached
-		   point yet.  move view->top down 10 lines and try again. */
-		size_t top_lineno = text_lineno_by_pos(buf->text, top);
-		view->top = text_pos_by_lineno(buf->text, top_lineno + 10);
+View *
+other_window(View *view)
+{
+	return view_select(view, view->next ? view->next : views);
+}
 
-		goto missed;
+/* Whether v is on side of view: above, left, below or right of it,
+   and not reaching past it */
+static int
+view_beside(View *view, View *v, int side)
+{
+	switch (side) {
+	case 0:
+	case 2:
+		return (side == 0 ? v->y + v->lines == view->y :
+		    v->y == view->y + view->lines) &&
+		    v->x >= view->x && v->x + v->width <= view->x + view->width;
+	default:
+		return (side == 1 ? v->x + v->width == view->x :
+		    v->x == view->x + view->width) &&
+		    v->y >= view->y && v->y + v->lines <= view->y + view->lines;
 	}
+}
 
-	if (point == text_size(buf->text)) {
-		getyx(stdscr, cur_y, cur_x);
-		if (buffer[i-1] == '\n') {
-			addch(' ');
-			line++;
-		} else {
-			// higlight non-EOL file end
-			addstr("\xE2\x97\x8A");  // U+25CA LOZENGE
-		}
-	}
+/* Delete view, giving its space to the windows on the first side they
+   fill, and select one of them */
+View *
+delete_window(View *view)
+{
+	View *to = 0, **p;
 
-	line++;
-	for (; line < lines - 2; line++) {
-		mvprintw(line, 0, "~");
+	if (view == views && !view->next) {
+		alert("Attempt to delete the sole window");
+		return view;
 	}
 
-	mvprintw(lines - 2, 0, "--%s- %s -- L%ld C%ld B%ld/%ld",
-	    text_modified(buf->text) ? "**" : "--",
-	    buf->name,
-	    lineno,
-	    point - bol_point + 1,
-	    point,
-	    text_size(buf->text)
-	);
-	mvchgat(lines - 2, 0, view->cols, A_REVERSE, 0, 0);
-	mvprintw(lines - 1, 0, "%s", message_buf);
+	for (int side = 0; side < 4 && !to; side++) {
+		int span = 0;
+		for (View *v = views; v; v = v->next)
+			if (view_beside(view, v, side))
+				span += side % 2 ? v->lines : v->width;
+		if (span != (side % 2 ? view->lines : view->width))
+			continue;
+
+		for (View *v = views; v; v = v->next) {
+			if (!view_beside(view, v, side))
+				continue;
+			if (side == 0)
+				view_place(v, v->y, v->x, v->lines + view->lines,
+				    v->width);
+			else if (side == 2)
+				view_place(v, view->y, v->x, v->lines + view->lines,
+				    v->width);
+			else if (side == 1)
+				view_place(v, v->y, v->x, v->lines,
+				    v->width + view->width);
+			else
+				view_place(v, v->y, view->x, v->lines,
+				    v->width + view->width);
+			if (!to)
+				to = v;
+		}
+	}
+	if (!to)
+		return view;  /* can't happen when windows are only split */
 
-	move(cur_y, cur_x);
+	for (p = &views; *p != view; p = &(*p)->next)
+		;
+	*p = view->next;
+	view_free(view);
+	return view_select(0, to);
+}
 
-	refresh();
+void
+delete_other_windows(View *view)
+{
+	while (views) {
+		View *v = views;
+		views = v->next;
+		if (v != view)
+			view_free(v);
+	}
+	views = view;
+	view->next = 0;
+	view_place(view, 0, 0, screen_lines - 1, screen_cols);
 }
 
-static void
-update_target_column(Buffer *buf)
+static int
+scale(int n, int to, int from)
 {
-	size_t point = text_mark_get(buf->text, buf->point);
-	buf->target_column = text_line_width_get(buf->text, point);
+	return (long)n * to / from;
 }
 
+/* Fit the windows to the screen when its size changed, keeping their
+   proportions, or only view if they got too small for that */
 void
-recenter(View *view)
+windows_fit(View *view)
 {
-	Buffer *buf = view->buf;
-
-	size_t point = text_mark_get(buf->text, buf->point);
-	ssize_t lineno = text_lineno_by_pos(buf->text, point);
+	int lines, cols, old_lines = screen_lines, old_cols = screen_cols;
 
-	size_t top_lineno = MAX(1, lineno - (view->lines-2)/2);
-	view->top = text_pos_by_lineno(buf->text, top_lineno);
+	getmaxyx(stdscr, lines, cols);
+	if (lines == screen_lines && cols == screen_cols)
+		return;
+	screen_lines = lines;
+	screen_cols = cols;
+
+	int fits = old_lines > 1 && old_cols > 0 && lines > 1;
+	for (View *v = views; v && fits; v = v->next) {
+		int y = scale(v->y, lines - 1, old_lines - 1);
+		int x = scale(v->x, cols, old_cols);
+		fits = scale(v->y + v->lines, lines - 1, old_lines - 1) - y >=
+		    WINDOW_MIN_LINES &&
+		    scale(v->x + v->width, cols, old_cols) - x >= WINDOW_MIN_COLS;
+	}
+	if (!fits || !views->next) {
+		delete_other_windows(view);
+		return;
+	}
 
-	buf->last_action = ACTION_OTHER;
+	for (View *v = views; v; v = v->next) {
+		int y = scale(v->y, lines - 1, old_lines - 1);
+		int x = scale(v->x, cols, old_cols);
+		view_place(v, y, x,
+		    scale(v->y + v->lines, lines - 1, old_lines - 1) - y,
+		    scale(v->x + v->width, cols, old_cols) - x);
+	}
 }
 
 void
-move_line(View *view, int off)
+move_line(View *view, long off)
 {
 	Buffer *buf = view->buf;
 
 	size_t point = text_mark_get(buf->text, buf->point);
+	long moved;
 
-	while (off) {
-		size_t old_point = point;
-
-		if (off > 0) {
-			off--;
-			point = text_line_down(buf->text, point);
-		} else {
-			off++;
-			point = text_line_up(buf->text, point);
-		}
-
-		if (point == old_point) {
-			flash();
-			break;
-		}
-	}
-
-	if (buf->target_column)
-		point = text_line_width_set(buf->text, point, buf->target_column);
+	/* move by screen rows, keeping the column */
+	if (buf->target_column == EPOS)
+		buf->target_column = view_column(view, point);
+	point = view_rows_move(view, point, off, &moved);
+	if (moved != labs(off))
+		command_failed();
+	point = view_column_set(view, point, buf->target_column);
 
 	buf->point = text_mark_set(buf->text, point);
 
@@ -322,27 +1595,34 @@ move_line(View *view, int off)
 	buf->last_action = ACTION_OTHER;
 }
 
-void
-move_char(Buffer *buf, int off)
+/* Position n characters after pos, or before it if n is negative, or
+   as far as the text goes; *moved is how many that is */
+static size_t
+char_skip(Text *txt, size_t pos, long n, long *moved)
 {
-	size_t point = text_mark_get(buf->text, buf->point);
+	Iterator it = text_iterator_get(txt, pos);
 
-	while (off) {
-		size_t old_point = point;
-
-		if (off > 0) {
-			off--;
-			point = text_char_next(buf->text, point);
-		} else {
-			off++;
-			point = text_char_prev(buf->text, point);
-		}
-
-		if (point == old_point) {
-			flash();
+	for (*moved = 0; *moved < labs(n); ++*moved) {
+		size_t old = it.pos;
+		if (n > 0)
+			text_iterator_char_next(&it, 0);
+		else
+			text_iterator_char_prev(&it, 0);
+		if (it.pos == old)
 			break;
-		}
 	}
+	return it.pos;
+}
+
+void
+move_char(Buffer *buf, long off)
+{
+	size_t point = text_mark_get(buf->text, buf->point);
+	long moved;
+
+	point = char_skip(buf->text, point, off, &moved);
+	if (moved != labs(off))
+		command_failed();
 
 	buf->point = text_mark_set(buf->text, point);
 	update_target_column(buf);
@@ -351,7 +1631,7 @@ move_char(Buffer *buf, int off)
 }
 
 void
-move_paragraph(Buffer *buf, int off)
+move_paragraph(Buffer *buf, long off)
 {
 	size_t point = text_mark_get(buf->text, buf->point);
 
@@ -367,7 +1647,7 @@ move_paragraph(Buffer *buf, int off)
 		}
 
 		if (point == old_point) {
-			flash();
+			command_failed();
 			break;
 		}
 	}
@@ -384,15 +1664,29 @@ record_undo(Buffer *buf)
 	text_snapshot(buf->text);
 }
 
+/* Insert the len bytes at s n times, all at once */
 void
-insert_char(Buffer *buf, int ch)
+insert_chars(Buffer *buf, const char *s, size_t len, long n)
 {
+	if (n <= 0)
+		return;
 	if (buf->last_action != ACTION_INSERT)
 		record_undo(buf);
 
 	size_t point = text_mark_get(buf->text, buf->point);
-	const char c = ch;
-	text_insert(buf->text, point, &c, 1);
+	if (n == 1) {
+		text_insert(buf->text, point, s, len);
+	} else {
+		char *all = malloc(len * n);
+		if (!all) {
+			command_failed();
+			return;
+		}
+		for (long i = 0; i < n; i++)
+			memcpy(all + i * len, s, len);
+		text_insert(buf->text, point, all, len * n);
+		free(all);
+	}
 
 	update_target_column(buf);
 
@@ -400,20 +1694,39 @@ insert_char(Buffer *buf, int ch)
 }
 
 void
-backspace(Buffer *buf)
+insert_char(Buffer *buf, int ch)
 {
-	if (buf->last_action != ACTION_BACKSPACE)
-		record_undo(buf);
+	const char c = ch;
+	insert_chars(buf, &c, 1, 1);
+}
 
+/* Delete n characters after point, or before it if n is negative, at
+   once, or none if there are not as many */
+static int
+delete_chars(Buffer *buf, long n)
+{
 	size_t point = text_mark_get(buf->text, buf->point);
-	size_t prev = text_char_prev(buf->text, point);
-	if (point == prev) {
-		flash();
-		return;
+	long moved;
+	size_t to = char_skip(buf->text, point, n, &moved);
+	if (moved == 0 || moved != labs(n)) {
+		command_failed();
+		return 0;
 	}
 
-	text_delete(buf->text, prev, point - prev);
-	buf->point = text_mark_set(buf->text, prev);
+	size_t from = MIN(point, to);
+	text_delete(buf->text, from, MAX(point, to) - from);
+	buf->point = text_mark_set(buf->text, from);
+	return 1;
+}
+
+void
+backspace(Buffer *buf, long n)
+{
+	if (buf->last_action != ACTION_BACKSPACE)
+		record_undo(buf);
+
+	if (!delete_chars(buf, -n))
+		return;
 
 	update_target_column(buf);
 
@@ -421,19 +1734,12 @@ backspace(Buffer *buf)
 }
 
 void
-delete(Buffer *buf)
+delete(Buffer *buf, long n)
 {
 	record_undo(buf);
 
-	size_t point = text_mark_get(buf->text, buf->point);
-	size_t next = text_char_next(buf->text, point);
-	if (point == next) {
-		flash();
+	if (!delete_chars(buf, n))
 		return;
-	}
-
-	text_delete(buf->text, point, next - point);
-	buf->point = text_mark_set(buf->text, point);
 
 	buf->last_action = ACTION_OTHER;
 }
@@ -470,29 +1776,54 @@ set_mark(Buffer *buf)
 	buf->last_action = ACTION_OTHER;
 }
 
+static Text *
+killring_entry(int i)
+{
+	return killring.entry[(killring.head - i + KILL_RING_MAX) % KILL_RING_MAX];
+}
+
+static void
+killring_drop_oldest(void)
+{
+	Text *old = killring_entry(killring.n - 1);
+	killring.bytes -= text_size(old);
+	text_free(old);
+	killring.n--;
+}
+
 static void
 save_range(Buffer *buf, size_t from, size_t to, int pend)
 {
 	size_t len = to - from;
-	char *killstr = malloc(len);
-	if (!killstr)
+
+	if (len == 0)
+		return;
+	int fresh = pend == 0 || killring.n == 0;  /* a new entry */
+	Text *txt = fresh ? text_load(0) : killring_entry(0);
+	if (!txt)
 		return;
-	text_bytes_get(buf->text, from, len, killstr);
 
-	if (pend == 0) {  /* replace */
-		text_snapshot(killring);
-		text_delete(killring, 0, text_size(killring));
-		text_insert(killring, 0, killstr, len);
-	} else if (pend == 1) { /* append */
-		text_insert(killring, text_size(killring), killstr, len);
-	} else if (pend == -1) { /* prepend */
-		text_insert(killring, 0, killstr, len);
+	/* the entry refers to the text of buf, nothing is copied */
+	if (!text_insert_text(txt, pend < 0 ? 0 : text_size(txt),
+	    buf->text, from, len)) {
+		if (fresh)
+			text_free(txt);
+		return;
 	}
-
-	free(killstr);
+	if (fresh) {
+		if (killring.n == KILL_RING_MAX)
+			killring_drop_oldest();
+		killring.head = (killring.head + 1) % KILL_RING_MAX;
+		killring.entry[killring.head] = txt;
+		killring.n++;
+	}
+	killring.bytes += len;
+	killring.yank = 0;
+	/* never the one just killed */
+	while (killring.n > 1 && killring.bytes > KILL_RING_BYTES)
+		killring_drop_oldest();
 }
 
-
 static void
 save_region(Buffer *buf)
 {
@@ -564,10 +1895,10 @@ kill_region_save(View *view)
 void
 view_scroll(View *view, int off)
 {
-	size_t top = view->top;
-	ssize_t lineno = text_lineno_by_pos(view->buf->text, top);
+	long moved;
+	size_t top = view_rows_move(view, view->top, off, &moved);
 
-	if (lineno == 1 && off < 0) {
+	if (moved == 0 && off < 0) {
 		size_t point = text_mark_get(view->buf->text, view->buf->point);
 		if (point == 0)
 			alert("Beginning of buffer");
@@ -578,11 +1909,7 @@ view_scroll(View *view, int off)
 		return;
 	}
 
-	lineno += off;
-	if (lineno < 1)
-		lineno = 1;
-	view->top = text_pos_by_lineno(view->buf->text, lineno);
-	if (view->top == EPOS) {
+	if (moved < off) {
 		size_t point = text_mark_get(view->buf->text, view->buf->point);
 		if (point == text_size(view->buf->text)) {
 			alert("End of buffer");
@@ -591,11 +1918,15 @@ view_scroll(View *view, int off)
 			    text_size(view->buf->text));
 		}
 		update_target_column(view->buf);
-		view->top = top;   // restore
 		return;
 	}
+	view->top = top;
 
-	view_render(view);  // compute end
+	view_rows_reset(view);
+	Row rows[view->nrows];
+	char edge[view->nrows];
+	int text_rows;
+	view->end = view_layout(view, view->top, rows, edge, &text_rows);
 
 	size_t point = text_mark_get(view->buf->text, view->buf->point);
 
@@ -603,11 +1934,14 @@ view_scroll(View *view, int off)
 		view->buf->point = text_mark_set(view->buf->text, view->top);
 		update_target_column(view->buf);
 	} else if (off < 0 && view->end < point) {  // scrolled up too much
+		size_t bol, row;
 		view->buf->point = text_mark_set(view->buf->text,
-		    text_line_start(view->buf->text, view->end));
+		    view_row(view, view->end, &bol, &row));
 		update_target_column(view->buf);
-	} else if (view->buf->target_column) {  // keep column on same page
-		point = text_line_width_set(view->buf->text, point, view->buf->target_column);
+	} else if (view->buf->target_column != EPOS) {  // keep column on same page
+		size_t bol, row;
+		point = view_row(view, point, &bol, &row);
+		point = view_column_set(view, point, view->buf->target_column);
 		view->buf->point = text_mark_set(view->buf->text, point);
 	}
 }
@@ -634,10 +1968,9 @@ end_of_buffer(View *view)
 
 	buf->point = text_mark_set(buf->text, text_size(buf->text));
 
-	ssize_t lineno = text_lineno_by_pos(buf->text, text_size(buf->text));
-
-	size_t top_lineno = MAX(1, lineno - (view->lines-3));
-	view->top = text_pos_by_lineno(buf->text, top_lineno);
+	long moved;
+	view->top = view_rows_move(view, text_size(buf->text),
+	    -(view->lines-2), &moved);
 
 	buf->last_action = ACTION_OTHER;
 }
@@ -672,20 +2005,14 @@ yank(Buffer *buf)
 {
 	size_t point = text_mark_get(buf->text, buf->point);
 
-	/* reset killring to latest addition */
-	while (text_later(killring) != EPOS)
-		;
+	killring.yank = 0;
 
-	if (text_size(killring)) {
+	if (killring.n > 0) {
 		record_undo(buf);
 
-		size_t len = text_size(killring);
-		char *killstr = malloc(len);
-		if (!killstr)
-			return;
-		text_bytes_get(killring, 0, len, killstr);
-
-		text_insert(buf->text, point, killstr, len);
+		Text *txt = killring_entry(0);
+		size_t len = text_size(txt);
+		text_insert_text(buf->text, point, txt, 0, len);
 
 		buf->mark = text_mark_set(buf->text, point);
 		buf->point = text_mark_set(buf->text, point + len);
@@ -702,16 +2029,9 @@ yank_pop(Buffer *buf)
 		return;
 	}
 
-	/* ring buffer */
-	if (text_earlier(killring) == EPOS)
-		while (text_later(killring) != EPOS)
-			;
-	if (!text_modified(killring))   /* skip the empty initial buffer */
-		while (text_later(killring) != EPOS)
-			;
-
-	if (!text_size(killring))
+	if (killring.n == 0)
 		return;
+	killring.yank = (killring.yank + 1) % killring.n;
 
 	record_undo(buf);
 
@@ -719,15 +2039,11 @@ yank_pop(Buffer *buf)
 	/* previous insertion point */
 	size_t mark = text_mark_get(buf->text, buf->mark);
 
-	size_t len = text_size(killring);
-	char *killstr = malloc(len);
-	if (!killstr)
-		return;
-	text_bytes_get(killring, 0, len, killstr);
-
+	Text *txt = killring_entry(killring.yank);
+	size_t len = text_size(txt);
 	text_delete(buf->text, mark, point - mark);
 	point = mark;
-	text_insert(buf->text, point, killstr, len);
+	text_insert_text(buf->text, point, txt, 0, len);
 
 	buf->mark = text_mark_set(buf->text, point);
 	buf->point = text_mark_set(buf->text, point + len);
@@ -735,22 +2051,93 @@ yank_pop(Buffer *buf)
 	buf->last_action = ACTION_YANK; /* ! */
 }
 
+/* Insert what the terminal sends until the end of a bracketed paste,
+   all at once and as one change to undo.  Keys are read as they are,
+   so a pasted tab is not magic_tab. */
+void
+paste(Buffer *buf)
+{
+	static const char end[] = "\e[201~";
+	size_t len = 0, size = 4096, matched = 0;
+	char *s = malloc(size);
+	int full = !s;
+
+	keypad(stdscr, FALSE);
+	while (matched < sizeof end - 1) {
+		int ch = getch();
+		if (ch == ERR)
+			break;
+		matched = ch == end[matched] ? matched + 1 : ch == end[0];
+
+		if (!full && len == size) {
+			char *t = realloc(s, 2 * size);
+			if (t) {
+				s = t;
+				size *= 2;
+			} else {
+				full = 1;  /* but read the rest anyway */
+			}
+		}
+		if (!full)
+			s[len++] = ch == '\r' ? '\n' : ch;
+	}
+	keypad(stdscr, TRUE);
+
+	if (full) {
+		free(s);
+		alert("Paste too large");
+		return;
+	}
+	len -= matched;
+	if (len > 0) {
+		record_undo(buf);
+
+		size_t point = text_mark_get(buf->text, buf->point);
+		text_insert(buf->text, point, s, len);
+
+		buf->mark = text_mark_set(buf->text, point);
+		buf->point = text_mark_set(buf->text, point + len);
+		update_target_column(buf);
+	}
+	free(s);
+
+	buf->last_action = ACTION_OTHER;
+}
+
+/* Kill the rest of the line, or n lines with their newlines, before
+   point if n is negative */
 void
-kill_eol(Buffer *buf)
+kill_eol(Buffer *buf, long n)
 {
 	record_undo(buf);
 
 	size_t point = text_mark_get(buf->text, buf->point);
-	size_t bol = text_line_start(buf->text, point);
-	size_t eol = text_line_end(buf->text, point);
-
-	if (point == bol || point == eol)
-		eol = text_line_next(buf->text, point);  // kill entire line
+	size_t from = point, to;
+	int append = buf->last_action == ACTION_KILL_EOL;
+
+	if (n == 0) {
+		size_t bol = text_line_start(buf->text, point);
+		to = text_line_end(buf->text, point);
+		if (point == bol || point == to)
+			to = text_line_next(buf->text, point);  // kill entire line
+	} else {
+		size_t line = text_lineno_by_pos(buf->text, point);
+		if (n > 0) {
+			to = text_pos_by_lineno(buf->text, line + n);
+			if (to == EPOS)
+				to = text_size(buf->text);
+		} else {
+			to = point;
+			from = text_pos_by_lineno(buf->text,
+			    line > (size_t)-n ? line + n : 1);
+			append = -append;
+		}
+	}
 
-	save_range(buf, point, eol, buf->last_action == ACTION_KILL_EOL);
+	save_range(buf, from, to, append);
 
-	text_delete(buf->text, point, eol - point);
-	buf->point = text_mark_set(buf->text, point);
+	text_delete(buf->text, from, to - from);
+	buf->point = text_mark_set(buf->text, from);
 
 	buf->last_action = ACTION_KILL_EOL;
 }
@@ -787,11 +2174,73 @@ background(View *view)
 {
 	view->buf->last_action = ACTION_OTHER;
 
+	input_modes(0);
 	endwin();
 	raise(SIGSTOP);
+	input_modes(1);
 	view_render(view);
 }
 
+/* Keyboard macros.  The keys typed between C-x ( and C-x ) are kept,
+   and C-x e returns them from getch again, as often as asked, without
+   drawing anything until they are done or a command fails. */
+#define KBD_MACRO_MAX 1000000   /* times to run one until it fails, at most */
+
+static struct {
+	int *keys;
+	size_t n;
+} kbd_macro;
+
+void
+start_kbd_macro(void)
+{
+	if (input_recording()) {
+		alert("Already defining kbd macro");
+		return;
+	}
+	input_record(1);
+	message("Defining kbd macro...");
+}
+
+void
+end_kbd_macro(void)
+{
+	if (!input_recording()) {
+		alert("Not defining kbd macro");
+		return;
+	}
+	input_record(0);
+
+	size_t n;
+	const int *keys = input_recorded(&n);
+	n = n >= 2 ? n - 2 : 0;  /* C-x ) or C-x e */
+	int *copy = malloc((n ? n : 1) * sizeof *copy);
+	if (!copy)
+		return;
+	memcpy(copy, keys, n * sizeof *copy);
+	free(kbd_macro.keys);
+	kbd_macro.keys = copy;
+	kbd_macro.n = n;
+	message("Keyboard macro defined");
+}
+
+/* Run the last keyboard macro count times, 0 until it fails or C-g
+   is typed, but KBD_MACRO_MAX times at most */
+void
+call_last_kbd_macro(unsigned long count)
+{
+	if (input_replaying())
+		return;
+	if (input_recording())
+		end_kbd_macro();
+	if (!kbd_macro.n) {
+		alert("No kbd macro has been defined");
+		return;
+	}
+	input_replay(kbd_macro.keys, kbd_macro.n,
+	    count ? count : KBD_MACRO_MAX);
+}
+
 char *
 minibuffer_read(View *view, const char *prompt, const char *prefill)
 {
@@ -802,10 +2251,11 @@ minibuffer_read(View *view, const char *prompt, const char *prefill)
 
 	int done = 0;
 	while (!done) {
-		move(view->lines - 1, 0);
+		move(screen_lines - 1, 0);
 		clrtoeol();
 		printw("%s %s", prompt, buf);
-		refresh();
+		if (!input_replaying())
+			refresh();
 
 		int ch = getch();
 		switch (ch) {
@@ -873,19 +2323,210 @@ yes_or_no_p(View *view, const char *question)
 	}
 }
 
-int quit;
+int quit;
+
+void
+want_quit(View *view) {
+	int modified = 0;
+
+	for (Buffer *b = buffers; b; b = b->next)
+		if (b->text && text_modified(b->text))
+			modified = 1;
+	if (modified) {
+		if (yes_or_no_p(view,
+		    "Modified buffers exist; really exit? (yes or no)"))
+			quit = 1;
+	} else {
+		quit = 1;
+	}
+
+	view->buf->last_action = ACTION_OTHER;
+}
+
+/* Buffers.  Files named on the command line become buffers right
+   away, but are only loaded when first shown, so starting te with
+   many of them costs no more than with one. */
+
+static Buffer *
+buffer_find(const char *name)
+{
+	Buffer *buf;
+
+	for (buf = buffers; buf; buf = buf->next)
+		if (strcmp(buf->name, name) == 0)
+			break;
+	return buf;
+}
+
+/* A buffer for file, named after it, or an empty one called name if
+   file is 0, last in the list */
+Buffer *
+buffer_new(const char *file, const char *name)
+{
+	Buffer *buf = calloc(1, sizeof *buf), **p;
+	char *unique;
+
+	if (file) {
+		name = strrchr(file, '/');
+		name = name ? name + 1 : file;
+	}
+	if (!buf || !(unique = malloc(strlen(name) + 16))) {
+		free(buf);
+		return 0;
+	}
+	/* name<2> if name is taken, like emacs */
+	strcpy(unique, name);
+	for (int n = 2; buffer_find(unique); n++)
+		sprintf(unique, "%s<%d>", name, n);
+
+	buf->file = file;
+	buf->name = unique;
+	for (p = &buffers; *p; p = &(*p)->next)
+		;
+	*p = buf;
+	return buf;
+}
+
+/* Load the text of buf, if that hasn't been done yet */
+void
+buffer_load(Buffer *buf)
+{
+	if (buf->text)
+		return;
+
+	errno = 0;
+	if (buf->file)
+		buf->text = text_load(buf->file);
+	if (!buf->text) {
+		if (errno == ENOENT)
+			message("(New file)");
+		else if (buf->file)
+			alert("Error opening %s: %s", buf->file, strerror(errno));
+		buf->text = text_load(0);
+	}
+	buf->point = buf->mark = text_mark_set(buf->text, 0);
+}
+
+/* Show buf in the selected window, where it was shown last */
+void
+buffer_show(View *view, Buffer *buf)
+{
+	Buffer **p;
+	Buffer *old = view->buf;
+
+	buffer_load(buf);
+	old->top = text_mark_set(old->text, view->top);
+
+	for (p = &buffers; *p != buf; p = &(*p)->next)
+		;
+	*p = buf->next;
+	buf->next = buffers;
+	buffers = buf;
+
+	size_t top = text_mark_get(buf->text, buf->top);
+	view->buf = buf;
+	view->top = top == EPOS ? 0 : top;
+	view->hscroll = 0;
+	update_target_column(buf);
+	buf->last_action = ACTION_OTHER;
+
+	window_title(0);
+	window_title(buf->name);
+}
+
+void
+switch_to_buffer(View *view)
+{
+	Buffer *other, *buf;
+	char prompt[128];
+
+	for (other = buffers; other == view->buf; other = other->next)
+		;
+	if (!other)
+		other = view->buf;
+	snprintf(prompt, sizeof prompt, "Switch to buffer (default %s):",
+	    other->name);
+
+	char *name = minibuffer_read(view, prompt, "");
+	if (!name)
+		return;
+	buf = *name ? buffer_find(name) : other;
+	if (!buf)
+		buf = buffer_new(0, name);
+	if (buf)
+		buffer_show(view, buf);
+}
+
+/* Show what libtext counted for the text of the selected buffer in
+   *stats*, to see why editing it got slow */
+void
+text_stats_show(View *view)
+{
+	Buffer *buf = view->buf, *out = buffer_find("*stats*");
+	TextStats st = text_stats(buf->text);
+	char s[1024];
+
+	int n = snprintf(s, sizeof s,
+	    "Text of %s\n\n"
+	    "pieces     %zu in use, %zu allocated\n"
+	    "changes    %zu\n"
+	    "revisions  %zu\n"
+	    "blocks     %zu in use, %zu added\n"
+	    "cache      %zu hits, %zu misses\n"
+	    "lines      %zu hits, %zu scans, %zu rescans, %zu bytes scanned\n"
+	    "bytes_get  %zu bytes copied\n"
+	    "memory     %zu bytes malloc, %zu bytes mmap, of all texts\n",
+	    buf->name, st.pieces, st.pieces_total, st.changes, st.revisions,
+	    st.blocks, st.blocks_total, st.cache_hits, st.cache_misses,
+	    st.lines_hits, st.lines_scans, st.lines_rescans, st.lines_scanned,
+	    st.bytes_get,
+	    st.malloc_bytes, st.mmap_bytes);
+
+	if (!out && !(out = buffer_new(0, "*stats*")))
+		return;
+	buffer_load(out);
+	text_delete(out->text, 0, text_size(out->text));
+	text_insert(out->text, 0, s, MIN((size_t)n, sizeof s - 1));
+	text_saved(out->text, 0);  /* nothing to save */
+	out->point = out->mark = text_mark_set(out->text, 0);
+	out->top = 0;
+	if (out != buf)
+		buffer_show(view, out);
+	else
+		view->top = 0;
+}
 
 void
-want_quit(View *view) {
-	if (text_modified(view->buf->text)) {
-		if (yes_or_no_p(view,
-		    "Modified buffers exist; really exit? (yes or no)"))
-			quit = 1;
-	} else {
-		quit = 1;
-	}
+find_file(View *view)
+{
+	const char *file = view->buf->file ? view->buf->file : "";
+	const char *slash = strrchr(file, '/');
+	char dir[1024];
+	Buffer *buf;
 
-	view->buf->last_action = ACTION_OTHER;
+	/* start in the directory of the buffer's file */
+	snprintf(dir, sizeof dir, "%.*s", slash ? (int)(slash - file + 1) : 0,
+	    file);
+	char *answer = minibuffer_read(view, "Find file:", dir);
+	if (!answer || !*answer)
+		return;
+
+	/* the file may be visited already, under another name */
+	struct stat st, bst;
+	int known = stat(answer, &st) == 0;
+	for (buf = buffers; buf; buf = buf->next)
+		if (buf->file && (strcmp(buf->file, answer) == 0 ||
+		    (known && stat(buf->file, &bst) == 0 &&
+		    st.st_dev == bst.st_dev && st.st_ino == bst.st_ino)))
+			break;
+	if (!buf) {
+		char *new_file = strdup(answer);
+		if (!new_file || !(buf = buffer_new(new_file, 0))) {
+			free(new_file);
+			return;
+		}
+	}
+	buffer_show(view, buf);
 }
 
 void
@@ -961,77 +2602,76 @@ isword(unsigned char c)
 	);
 }
 
-void
-backward_word(Buffer *buf)
+/* Position after the nth word after pos, or at the start of the nth
+   before it if n is negative */
+static size_t
+word_skip(Text *txt, size_t pos, long n)
 {
-	size_t point = text_mark_get(buf->text, buf->point);
-
 	char c;
-	Iterator it = text_iterator_get(buf->text, point);
-	while (text_iterator_char_prev(&it, &c) && !isword((unsigned char)c))
-		;
-	while (text_iterator_char_prev(&it, &c) && isword((unsigned char)c))
-		;
-	text_iterator_char_next(&it, &c);
-
-	buf->point = text_mark_set(buf->text, it.pos);
+	Iterator it = text_iterator_get(txt, pos);
 
-	buf->last_action = ACTION_OTHER;
+	for (; n > 0; n--) {
+		while (text_iterator_char_next(&it, &c) && !isword((unsigned char)c))
+			;
+		while (text_iterator_char_next(&it, &c) && isword((unsigned char)c))
+			;
+	}
+	for (; n < 0; n++) {
+		while (text_iterator_char_prev(&it, &c) && !isword((unsigned char)c))
+			;
+		while (text_iterator_char_prev(&it, &c) && isword((unsigned char)c))
+			;
+		text_iterator_char_next(&it, &c);
+	}
+	return it.pos;
 }
 
 void
-forward_word(Buffer *buf)
+backward_word(Buffer *buf, long n)
 {
 	size_t point = text_mark_get(buf->text, buf->point);
 
-	char c;
-	Iterator it = text_iterator_get(buf->text, point);
-	while (text_iterator_char_next(&it, &c) && !isword((unsigned char)c))
-		;
-	while (text_iterator_char_next(&it, &c) && isword((unsigned char)c))
-		;
-
-	buf->point = text_mark_set(buf->text, it.pos);
+	buf->point = text_mark_set(buf->text, word_skip(buf->text, point, -n));
 
 	buf->last_action = ACTION_OTHER;
 }
 
 void
-kill_word(Buffer *buf)
+forward_word(Buffer *buf, long n)
 {
-	int append = buf->last_action == ACTION_KILL_WORD;
-
-	record_undo(buf);
-
-	size_t from = text_mark_get(buf->text, buf->point);
-	forward_word(buf);
-	size_t to = text_mark_get(buf->text, buf->point);
-
-	save_range(buf, from, to, append);
-	text_delete(buf->text, from, to - from);
-
-	buf->point = text_mark_set(buf->text, from);
-
-	buf->last_action = ACTION_KILL_WORD;
+	backward_word(buf, -n);
 }
 
+/* Kill n words after point, or before it if n is negative */
 void
-backward_kill_word(Buffer *buf)
+kill_word(Buffer *buf, long n)
 {
-	int prepend = buf->last_action == ACTION_BACKWARD_KILL_WORD;
+	int action = n < 0 ? ACTION_BACKWARD_KILL_WORD : ACTION_KILL_WORD;
+	int pend = (int)buf->last_action == action;
 
 	record_undo(buf);
 
-	size_t to = text_mark_get(buf->text, buf->point);
-	backward_word(buf);
 	size_t from = text_mark_get(buf->text, buf->point);
+	size_t to = word_skip(buf->text, from, n);
+	if (n < 0) {
+		size_t t = from;
+		from = to;
+		to = t;
+		pend = -pend;
+	}
 
-	save_range(buf, from, to, -prepend);
+	save_range(buf, from, to, pend);
 	text_delete(buf->text, from, to - from);
 
 	buf->point = text_mark_set(buf->text, from);
 
-	buf->last_action = ACTION_BACKWARD_KILL_WORD;
+	buf->last_action = action;
+}
+
+void
+backward_kill_word(Buffer *buf, long n)
+{
+	kill_word(buf, -n);
 }
 
 void
@@ -1236,7 +2876,41 @@ goto_line(View *view)
 	buf->last_action = ACTION_OTHER;
 }
 
+/* shared with a search running on the search thread */
+typedef struct {
+	atomic_int cancel;
+	atomic_size_t scanned;  /* bytes looked at so far */
+} SearchProgress;
+
+/* searches look at no more than this many bytes between progress checks */
+#define SEARCH_SLICE (1 << 20)
+
+/* the search running on the search thread, if any */
+static struct {
+	pthread_t thread;
+	int running;
+	int done[2];            /* pipe written to when the search ends */
+	SearchProgress progress;
+
+	Text *txt;
+	pcre2_code *re;         /* 0 for a literal search of term */
+	const struct ReCache *cache;  /* of the thread starting the search */
+	char term[1024];
+	int dir;
+	size_t from, to;
+	uint32_t options;
+
+	int rc;                 /* result of a regexp search */
+	Filerange match;
+	size_t found;           /* result of a literal search, or EPOS */
+} search;
+
 static size_t do_re_search_forward(Buffer *buf, char *search_term, size_t point, size_t point_max);
+static pcre2_code *re_compile(const char *search_term);
+static size_t re_search_result(Buffer *buf, int rc, Filerange *match);
+static void search_start(Text *txt, pcre2_code *re, const char *term, int dir, size_t from, size_t to, uint32_t options);
+static int search_wait(const char *prompt);
+static void search_cancel(void);
 
 void
 re_search_forward(View *view)
@@ -1252,10 +2926,35 @@ re_search_forward(View *view)
 	if (*answer)
 		strcpy(search_term, answer);
 
-	size_t found = do_re_search_forward(buf, search_term,
-	    point, text_size(buf->text));
+	pcre2_code *re = re_compile(search_term);
+	if (!re) {
+		command_failed();
+		return;
+	}
+
+	/* keys typed meanwhile are replayed afterwards, only C-g
+	   abandons the search */
+	Array typeahead;
+	int ch;
+	array_init_sized(&typeahead, sizeof(int));
+	search_start(buf->text, re, 0, +1, point, text_size(buf->text),
+	    point == 0 ? 0 : PCRE2_NOTEMPTY_ATSTART);
+	while ((ch = search_wait("Regexp search:")) != ERR) {
+		if (ch == CTRL('g')) {
+			search_cancel();
+			array_release(&typeahead);
+			alert("Quit");
+			return;
+		}
+		array_add(&typeahead, &ch);
+	}
+	for (size_t n = array_length(&typeahead); n > 0; n--)
+		ungetch(*(int *)array_get(&typeahead, n - 1));
+	array_release(&typeahead);
+
+	size_t found = re_search_result(buf, search.rc, &search.match);
 	if (found == EPOS) {
-		flash();
+		command_failed();
 	} else {
 		buf->point = text_mark_set(buf->text, buf->match_end);
 
@@ -1333,13 +3032,184 @@ re_search_backward(View *view)
 	buf->last_action = ACTION_OTHER;
 }
 
+/* the most recently used pattern stays compiled, together with what
+   is known about where its matches can start, in each thread */
+static _Thread_local struct ReCache {
+	char term[1024];
+	pcre2_code *re;
+	pcre2_match_data *match_data;
+
+	char literal[256];      /* literal prefix of every match */
+	size_t literal_len;
+	char first[256];        /* possible first bytes of a match */
+	int nfirst;             /* number of them, 0 if unknown */
+	int required;           /* byte contained in every match, or -1 */
+	size_t lookbehind;      /* bytes of context needed before a match */
+} re_cache;
+
+/* Extract the literal text every match of pattern starts with. */
 static size_t
-do_re_search_forward(Buffer *buf, char *search_term, size_t point, size_t point_max)
+re_literal_prefix(const char *pattern, char *literal, size_t size)
 {
-	size_t len = 4 * 4096;
-	char *search_buffer = malloc(len);
-	if (!search_buffer)
-		return EPOS;
+	const char *p;
+	int depth = 0;
+
+	/* a top-level alternative means there is no common prefix */
+	for (p = pattern; *p; p++) {
+		if (*p == '\\') {
+			if (p[1] == 'Q' || !*++p)
+				return 0;
+		} else if (*p == '[') {
+			p++;
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			for (; *p && *p != ']'; p++) {
+				if (*p == '\\' && p[1])
+					p++;
+				else if (p[0] == '[' && p[1] == ':')
+					if (!(p = strstr(p, ":]")))
+						return 0;
+			}
+			if (!*p)
+				return 0;
+		} else if (*p == '(') {
+			depth++;
+		} else if (*p == ')') {
+			depth--;
+		} else if (*p == '|' && depth == 0) {
+			return 0;
+		}
+	}
+
+	size_t len = 0;
+	for (p = pattern; *p; ) {
+		const char *c = p;
+		size_t clen = 1;
+
+		if (*p == '\\') {
+			if (isalnum((unsigned char)p[1]))
+				break;  /* \d, \b, \x{...} etc. */
+			c = ++p;
+		} else if (strchr(".[]()*+?{}|^$", *p)) {
+			break;
+		} else {
+			while (!ISUTF8(p[clen]))
+				clen++;
+		}
+		p += clen;
+
+		/* the last character might be repeated zero times */
+		if (*p == '*' || *p == '?' || *p == '{')
+			break;
+		if (len + clen > size)
+			break;
+		memcpy(literal + len, c, clen);
+		len += clen;
+		if (*p == '+')
+			break;
+	}
+
+	return len;
+}
+
+static void
+re_study(const char *search_term, pcre2_code *re)
+{
+	uint32_t type = 0, unit = 0, lookbehind = 0;
+	const uint8_t *bitmap = 0;
+
+	re_cache.literal_len = re_literal_prefix(search_term,
+	    re_cache.literal, sizeof re_cache.literal);
+
+	memset(re_cache.first, 0, sizeof re_cache.first);
+	re_cache.nfirst = 0;
+	pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODETYPE, &type);
+	if (type == 1) {
+		pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODEUNIT, &unit);
+		re_cache.first[unit] = 1;
+		/* may be a caseless match of an ASCII letter */
+		if (ISASCII(unit) && isalpha(unit))
+			re_cache.first[unit ^ 0x20] = 1;
+	} else if (type == 0) {
+		pcre2_pattern_info(re, PCRE2_INFO_FIRSTBITMAP, &bitmap);
+		for (int c = 0; bitmap && c < 256; c++)
+			if (bitmap[c/8] & (1 << (c%8)))
+				re_cache.first[c] = 1;
+	}
+	for (int c = 0; c < 256; c++)
+		re_cache.nfirst += re_cache.first[c];
+
+	/* caseless matching makes letters unreliable here */
+	re_cache.required = -1;
+	pcre2_pattern_info(re, PCRE2_INFO_LASTCODETYPE, &type);
+	pcre2_pattern_info(re, PCRE2_INFO_LASTCODEUNIT, &unit);
+	if (type == 1 && ISASCII(unit) && !isalpha(unit))
+		re_cache.required = unit;
+
+	/* lookbehinds are measured in characters */
+	pcre2_pattern_info(re, PCRE2_INFO_MAXLOOKBEHIND, &lookbehind);
+	re_cache.lookbehind = MAX(1, 4 * (size_t)lookbehind);
+}
+
+/* Skip to the first position in [pos, max) where a match of the
+   cached pattern can start, or EPOS if there is none.  *required
+   caches the next occurrence of the required byte, it is set to
+   the text size if there is none. */
+static size_t
+re_prefilter(Text *txt, size_t pos, size_t max, size_t *required)
+{
+	Filerange r = { pos, max };
+	size_t found = EPOS;
+
+	if (re_cache.literal_len >= 2) {
+		found = text_find_range_next(txt, &r,
+		    re_cache.literal, re_cache.literal_len);
+	} else if (re_cache.nfirst > 0) {
+		int c = (char *)memchr(re_cache.first, 1, 256) - re_cache.first;
+
+		for (Iterator it = text_iterator_get(txt, pos);
+		    found == EPOS && text_iterator_valid(&it) && it.pos < max;
+		    text_iterator_next(&it)) {
+			const char *s = it.text;
+			size_t n = MIN((size_t)(it.end - s), max - it.pos);
+			const char *hit = 0;
+
+			if (re_cache.nfirst == 1) {
+				hit = memchr(s, c, n);
+			} else {
+				for (size_t i = 0; i < n && !hit; i++)
+					if (re_cache.first[(unsigned char)s[i]])
+						hit = s + i;
+			}
+			if (hit)
+				found = it.pos + (hit - s);
+		}
+	} else {
+		found = pos;
+	}
+
+	if (found != EPOS && re_cache.required >= 0) {
+		if (*required == EPOS || *required < found) {
+			Filerange rest = { found, text_size(txt) };
+			char c = re_cache.required;
+			*required = text_find_range_next(txt, &rest, &c, 1);
+			if (*required == EPOS)
+				*required = text_size(txt);
+		}
+		if (*required == text_size(txt))
+			found = EPOS;
+	}
+
+	return found;
+}
+
+static pcre2_code *
+re_compile(const char *search_term)
+{
+	if (re_cache.re && strcmp(re_cache.term, search_term) == 0)
+		return re_cache.re;
 
 	pcre2_code *re;
 	int errornumber;
@@ -1358,91 +3228,520 @@ do_re_search_forward(Buffer *buf, char *search_term, size_t point, size_t point_
 		pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
 		message("ERROR: %jd: %s\n", erroroffset, buffer);
 
-		return EPOS;
+		return 0;
 	}
 
 	pcre2_match_data *match_data =
 	    pcre2_match_data_create_from_pattern(re, 0);
+	if (!match_data) {
+		pcre2_code_free(re);
+		return 0;
+	}
+
+	pcre2_match_data_free(re_cache.match_data);
+	pcre2_code_free(re_cache.re);
+	re_cache.re = re;
+	re_cache.match_data = match_data;
+	snprintf(re_cache.term, sizeof re_cache.term, "%s", search_term);
+	re_study(search_term, re);
+
+	return re;
+}
+
+/* Find the first match of re starting in [point, point_max), the
+   options are only applied to a match attempt at point.  Returns the
+   pcre2_match result and stores the match range when positive.
+   A background search reports and checks its state in progress. */
+static int
+re_search_text(Text *txt, pcre2_code *re, size_t point, size_t point_max,
+    uint32_t options, Filerange *match, SearchProgress *progress)
+{
+	/* small, as PCRE2 checks all of it for invalid UTF-8 on each call,
+	   and grown for matches that don't fit */
+	size_t len = 1024;
+	char *search_buffer = malloc(len);
+	if (!search_buffer)
+		return PCRE2_ERROR_NOMEMORY;
 
-	size_t found;
+	size_t size = text_size(txt);
+
+	/* keep some bytes in front of point, so ^, \b and lookbehinds
+	   see their context, and \A only matches for point == 0 */
+	size_t start_offset = MIN(point, re_cache.lookbehind);
+	size_t from = point - start_offset;
 	int rc = PCRE2_ERROR_NOMATCH;
-	size_t start_offset = 0;
 
-	while (point < point_max) {
+	int prefilter = re_cache.literal_len >= 2 || re_cache.nfirst > 0 ||
+	    re_cache.required >= 0;
+	int skip = prefilter;
+	size_t required = EPOS;
+
+	while (from + start_offset < point_max) {
+		if (progress) {
+			if (atomic_load(&progress->cancel)) {
+				rc = PCRE2_ERROR_NOMATCH;
+				break;
+			}
+			atomic_store(&progress->scanned, from + start_offset - point);
+		}
+
+		if (skip) {
+			/* don't bother PCRE2 with text that cannot match,
+			   but look at no more than a slice at a time */
+			size_t limit = MIN(point_max,
+			    from + start_offset + SEARCH_SLICE);
+			size_t candidate = re_prefilter(txt,
+			    from + start_offset, limit, &required);
+			if (candidate == EPOS) {
+				if (limit == point_max || required == size)
+					break;
+				start_offset = MIN(limit, re_cache.lookbehind);
+				from = limit - start_offset;
+				continue;
+			}
+			start_offset = MIN(candidate, re_cache.lookbehind);
+			from = candidate - start_offset;
+		}
+
 		size_t slen =
-		    text_bytes_get(buf->text, point, len, search_buffer);
+		    text_bytes_get(txt, from, len, search_buffer);
 
-		/* XXX TODO: make start_offset != 0 when point > 0
-		   so that \A only matches for point == 0 */
-		/* XXX compute NOTEOL ?? needed */
+		/* only the end of the text is the end of the subject */
+		uint32_t partial = from + slen < size ? PCRE2_PARTIAL_HARD : 0;
 
 		rc = pcre2_match(
 		    re,                   /* the compiled pattern */
 		    (unsigned char *)search_buffer, /* the subject string */
 		    slen,                 /* the length of the subject */
 		    start_offset,         /* start search at point */
-		    PCRE2_PARTIAL_HARD |
-		      (point == 0 ? 0 : PCRE2_NOTEMPTY_ATSTART | PCRE2_NOTBOL),
-		    match_data,           /* block for storing the result */
+		    partial |
+		      (from + start_offset == point ? options : 0),
+		    re_cache.match_data,  /* block for storing the result */
 		    0);
 
-		if (rc < 0) {
-			found = EPOS;
-			if (rc == PCRE2_ERROR_NOMATCH) {
-				start_offset = 0;
-				point += slen; // try next chunk
-				len = 4 * 4096;
-				// do not realloc, will shrink below
-			} else if (rc == PCRE2_ERROR_PARTIAL) {
-				size_t *ovector = pcre2_get_ovector_pointer(match_data);
-
-				if (ovector[1] == slen &&
-				    point + slen >= text_size(buf->text)) {
-					/* final match at end of buffer */
-					rc = 1;
-					goto match_til_eob;
-				}
+		size_t *ovector = pcre2_get_ovector_pointer(re_cache.match_data);
+
+		if (rc > 0) {
+			match->start = from + ovector[0];
+			match->end = from + ovector[1];
+			break;
+		} else if (rc == PCRE2_ERROR_NOMATCH && partial) {
+			/* try next chunk, no match starts before it */
+			start_offset = MIN(from + slen, re_cache.lookbehind);
+			from += slen - start_offset;
+			skip = prefilter;
+		} else if (rc == PCRE2_ERROR_PARTIAL) {
+			/* retry at the partial match with a larger buffer */
+			size_t context = MIN(ovector[0], re_cache.lookbehind);
+			from += ovector[0] - context;
+			start_offset = context;
+			skip = 0;
+
+			char *new_buffer = realloc(search_buffer, len*2);
+			if (!new_buffer) {
+				rc = PCRE2_ERROR_NOMEMORY;
+				break;
+			}
+			len *= 2;
+			search_buffer = new_buffer;
+		} else {
+			break;
+		}
+	}
+
+	if (rc == PCRE2_ERROR_PARTIAL)
+		rc = PCRE2_ERROR_NOMATCH;
+
+	free(search_buffer);
+
+	return rc;
+}
+
+static size_t
+do_re_search_forward(Buffer *buf, char *search_term, size_t point, size_t point_max)
+{
+	pcre2_code *re = re_compile(search_term);
+	if (!re)
+		return EPOS;
+
+	Filerange match;
+	int rc = re_search_text(buf->text, re, point, point_max,
+	    point == 0 ? 0 : PCRE2_NOTEMPTY_ATSTART, &match, 0);
+
+	return re_search_result(buf, rc, &match);
+}
+
+static size_t
+re_search_result(Buffer *buf, int rc, Filerange *match)
+{
+	if (rc > 0) {
+		buf->match_start = match->start;
+		buf->match_end = match->end;
+
+		return match->start;
+	}
+
+	if (rc == PCRE2_ERROR_NOMATCH) {
+		message("No match found.");
+		buf->match_start = buf->match_end = 0;
+	} else {
+		message("PCRE2 error %d", rc);
+		command_failed();
+	}
+
+	return EPOS;
+}
+
+static void
+search_run(void)
+{
+	SearchProgress *progress = &search.progress;
+	size_t len = strlen(search.term);
+
+	if (search.re) {
+		search.rc = re_search_text(search.txt, search.re,
+		    search.from, search.to, search.options, &search.match,
+		    progress);
+		return;
+	}
+
+	search.found = EPOS;
+	if (search.dir == +1) {
+		for (size_t pos = search.from;
+		    pos < search.to && search.found == EPOS &&
+		    !atomic_load(&progress->cancel);
+		    pos += SEARCH_SLICE) {
+			Filerange r = { pos, MIN(search.to, pos + SEARCH_SLICE) };
+			search.found = text_find_range_next(search.txt, &r,
+			    search.term, len);
+			atomic_store(&progress->scanned, r.end - search.from);
+		}
+	} else {
+		for (size_t end = search.to;
+		    end > search.from && search.found == EPOS &&
+		    !atomic_load(&progress->cancel); ) {
+			Filerange r = { end - MIN(end - search.from, SEARCH_SLICE), end };
+			search.found = text_find_range_prev(search.txt, &r,
+			    search.term, len);
+			atomic_store(&progress->scanned, search.to - r.start);
+			if (r.start == search.from)
+				break;
+			/* overlap so matches across slices are found */
+			end = r.start + len - 1;
+		}
+	}
+}
+
+static void *
+search_thread(void *arg)
+{
+	(void)arg;
+	re_cache = *search.cache;
+	search_run();
+	/* wake up search_wait */
+	while (write(search.done[1], "", 1) < 0 && errno == EINTR)
+		;
+	return 0;
+}
+
+/* Start searching txt in [from, to), for the regexp re or else for
+   the literal term.  The text must not change until search_wait
+   returns ERR or search_cancel was called. */
+static void
+search_start(Text *txt, pcre2_code *re, const char *term, int dir,
+    size_t from, size_t to, uint32_t options)
+{
+	search.txt = txt;
+	search.re = re;
+	search.cache = &re_cache;
+	snprintf(search.term, sizeof search.term, "%s", term ? term : "");
+	search.dir = dir;
+	search.from = from;
+	search.to = to;
+	search.options = options;
+	atomic_store(&search.progress.cancel, 0);
+	atomic_store(&search.progress.scanned, 0);
+
+	if (!search.done[1] && pipe(search.done) < 0)
+		search.done[1] = 0;
+	search.running = search.done[1] &&
+	    pthread_create(&search.thread, 0, search_thread, 0) == 0;
+	if (!search.running)
+		search_run();
+}
+
+static void
+search_join(void)
+{
+	char c;
+
+	pthread_join(search.thread, 0);
+	while (read(search.done[0], &c, 1) < 0 && errno == EINTR)
+		;
+	search.running = 0;
+}
+
+/* Wait for the search to end, showing its progress after prompt.
+   Returns ERR once it did, or a key typed meanwhile; the search is
+   still running then. */
+static int
+search_wait(const char *prompt)
+{
+	struct pollfd fds[2] = {
+		{ .fd = 0, .events = POLLIN },
+		{ .fd = search.done[0], .events = POLLIN },
+	};
+	int cur_x, cur_y;
+	int typing = !input_replaying();  /* a macro's keys are no typeahead */
+
+	while (search.running) {
+		if (typing) {
+			nodelay(stdscr, TRUE);
+			int ch = getch();
+			nodelay(stdscr, FALSE);
+			if (ch != ERR)
+				return ch;
+		}
+
+		int n = poll(fds + !typing, 2 - !typing, 100);
+		if (n > 0 && (fds[1].revents & POLLIN)) {
+			search_join();
+		} else if (n == 0 && typing) {
+			getyx(stdscr, cur_y, cur_x);
+			move(screen_lines - 1, 0);
+			clrtoeol();
+			printw("%s searching... %zu MB", prompt,
+			    atomic_load(&search.progress.scanned) >> 20);
+			move(cur_y, cur_x);
+			refresh();
+		}
+	}
+
+	return ERR;
+}
+
+/* Abandon the running search, its result is garbage. */
+static void
+search_cancel(void)
+{
+	if (search.running) {
+		atomic_store(&search.progress.cancel, 1);
+		search_join();
+	}
+}
+
+/* every occurrence of the isearch term, overlapping ones included,
+   counted on a thread of its own */
+static struct {
+	pthread_t thread;
+	int running;
+	int done[2];            /* pipe written to when counting ends */
+	atomic_int cancel;
+
+	Text *txt;
+	size_t version;         /* text_version when counting started */
+	char term[1024];
+	int refine;             /* filter pos instead of scanning txt */
+	int valid;              /* counting ran to completion */
+	Array pos;              /* match positions, ascending */
+	size_t limit;           /* all matches before it are in pos */
+} count;
+
+/* stop collecting positions after this many matches */
+#define COUNT_MAX (1 << 20)
+
+static int
+count_add(size_t pos)
+{
+	if (array_length(&count.pos) >= COUNT_MAX) {
+		count.limit = pos;
+		return 0;
+	}
+	return array_add(&count.pos, &pos);
+}
+
+static void
+count_refine(void)
+{
+	Text *txt = count.txt;
+	const char *term = count.term;
+	size_t len = strlen(term);
+	size_t n = array_length(&count.pos), kept = 0;
+
+	/* matches of a longer term are a subset */
+	for (size_t i = 0; i < n; i++) {
+		if (atomic_load(&count.cancel))
+			return;
+		size_t pos = *(size_t *)array_get(&count.pos, i);
+		Filerange r = { pos, pos + 1 };
+		if (text_find_range_next(txt, &r, term, len) == pos)
+			array_set(&count.pos, kept++, &pos);
+	}
+	array_truncate(&count.pos, kept);
+}
+
+static void
+count_scan(void)
+{
+	Text *txt = count.txt;
+	const char *term = count.term;
+	size_t len = strlen(term);
+
+	array_clear(&count.pos);
+	count.limit = text_size(txt);
+	for (Iterator it = text_iterator_get(txt, 0);
+	    text_iterator_valid(&it);
+	    text_iterator_next(&it)) {
+		const char *s = it.text, *end = it.end;
+
+		for (const char *p = s; (p = memmem(p, end - p, term, len)); p++)
+			if (atomic_load(&count.cancel) ||
+			    !count_add(it.pos + (p - s)))
+				return;
+
+		/* matches continuing into the next piece */
+		size_t piece_end = it.pos + (end - s);
+		Filerange r = {
+			piece_end - MIN(len - 1, (size_t)(end - s)),
+			piece_end
+		};
+		size_t pos;
+		while ((pos = text_find_range_next(txt, &r, term, len)) != EPOS) {
+			if (!count_add(pos))
+				return;
+			r.start = pos + 1;
+		}
+	}
+}
+
+static void *
+count_thread(void *arg)
+{
+	(void)arg;
+	if (count.refine)
+		count_refine();
+	else
+		count_scan();
+	count.valid = !atomic_load(&count.cancel);
+	/* wake up isearch_getch */
+	while (write(count.done[1], "", 1) < 0 && errno == EINTR)
+		;
+	return 0;
+}
+
+static void
+count_join(void)
+{
+	char c;
+
+	pthread_join(count.thread, 0);
+	while (read(count.done[0], &c, 1) < 0 && errno == EINTR)
+		;
+	count.running = 0;
+}
+
+static void
+count_cancel(void)
+{
+	if (count.running) {
+		atomic_store(&count.cancel, 1);
+		count_join();
+	}
+}
 
-				start_offset = ovector[0];
+/* Start counting the matches of term in txt, unless they are known. */
+static void
+count_start(Text *txt, const char *term)
+{
+	int same = count.txt == txt && count.version == text_version(txt);
 
-				char *new_buffer = realloc(search_buffer, len*2);
-				if (new_buffer) {
-					len *= 2;
-					search_buffer = new_buffer;
-				}
-			} else {
-				break;
-			}
-		} else if (rc > 0) {
-			size_t *ovector;
-match_til_eob:
-			ovector = pcre2_get_ovector_pointer(match_data);
+	if (same && count.valid && strcmp(count.term, term) == 0)
+		return;
 
-			buf->match_start = point + ovector[0];
-			buf->match_end = point + ovector[1];
+	count_cancel();
+	if (!count.pos.elem_size)
+		array_init_sized(&count.pos, sizeof(size_t));
+
+	/* a longer term only needs the old matches checked */
+	count.refine = same && count.valid &&
+	    strncmp(count.term, term, strlen(count.term)) == 0;
+	count.valid = 0;
+	count.txt = txt;
+	count.version = text_version(txt);
+	snprintf(count.term, sizeof count.term, "%s", term);
+	atomic_store(&count.cancel, 0);
+
+	if (!count.done[1] && pipe(count.done) < 0)
+		count.done[1] = 0;
+	count.running = count.done[1] &&
+	    pthread_create(&count.thread, 0, count_thread, 0) == 0;
+	/* without a thread there is no count */
+}
 
-			found = point + ovector[0];
+/* Format "N of M" for the match at pos, or nothing while unknown. */
+static void
+count_format(char *out, size_t size, const char *term, size_t pos)
+{
+	*out = 0;
+	if (count.running || !count.valid || strcmp(count.term, term) != 0 ||
+	    count.version != text_version(count.txt))
+		return;
 
-			break; // LEAK match_data
-		}
+	size_t n = array_length(&count.pos);
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (*(size_t *)array_get(&count.pos, mid) < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	const char *more = count.limit < text_size(count.txt) ? "+" : "";
 
-	if (rc < 0) {
-		found = EPOS;
-		if (rc == PCRE2_ERROR_NOMATCH) {
-			message("No match found.");
-			buf->match_start = buf->match_end = 0;
-		} else {
-			message("PCRE2 error %d", rc);
-			flash();
+	if (pos < count.limit && lo < n &&
+	    *(size_t *)array_get(&count.pos, lo) == pos)
+		snprintf(out, size, " [%zu of %zu%s]", lo + 1, n, more);
+	else
+		snprintf(out, size, " [%zu%s matches]", n, more);
+}
+
+/* Read a key, redrawing the prompt when the count becomes known. */
+static int
+isearch_getch(void)
+{
+	if (count.running) {
+		nodelay(stdscr, TRUE);
+		int ch = getch();
+		nodelay(stdscr, FALSE);
+		if (ch != ERR)
+			return ch;
+
+		struct pollfd fds[2] = {
+			{ .fd = 0, .events = POLLIN },
+			{ .fd = count.done[0], .events = POLLIN },
+		};
+		while (poll(fds, 2, -1) < 0 && errno == EINTR)
+			;
+		if (fds[1].revents & POLLIN) {
+			count_join();
+			return ERR;
 		}
 	}
+	return getch();
+}
 
-	pcre2_match_data_free(match_data);
-	pcre2_code_free(re);
-	free(search_buffer);
-
-	return found;
+static void
+isearch_prompt(char *prompt, size_t size, int failed, int dir,
+    const char *term, size_t match_start)
+{
+	char matches[64] = "";
+
+	if (*term && !failed)
+		count_format(matches, sizeof matches, term, match_start);
+	snprintf(prompt, size, "%s%s: %s%s",
+	    failed ? "Failing I-search" : "I-search",
+	    dir == +1 ? "" : " backward",
+	    term, matches);
 }
 
 void
@@ -1460,33 +3759,40 @@ isearch(View *view, int dir)
 
 	int failed = 0;
 	int cur_x, cur_y;
+	int pending = ERR;  /* key that interrupted the search */
+	char prompt[sizeof term + 96];
 
 	buf->match_start = buf->match_end = 0;
 
 	while (1) {
 		getyx(stdscr, cur_y, cur_x);
 
-		move(view->lines - 1, 0);
+		isearch_prompt(prompt, sizeof prompt, failed, dir, term,
+		    buf->match_start);
+		move(screen_lines - 1, 0);
 		clrtoeol();
-		printw("%s%s: %s",
-		    failed ? "Failing I-search" : "I-search",
-		    dir == +1 ? "" : " backward",
-		    term);
+		printw("%s", prompt);
 
 		move(cur_y, cur_x);  /* move cursor to point */
-		refresh();
+		if (!input_replaying())
+			refresh();
 
-		int ch = getch();
+		int ch = pending != ERR ? pending : isearch_getch();
+		pending = ERR;
+		if (ch == ERR)
+			continue;  /* the count is known now */
 		switch (ch) {
 		case CTRL('g'):
+			count_cancel();
 			alert("Quit");
 			buf->point = text_mark_set(buf->text, point);
 			buf->match_start = buf->match_end = 0;
 			return;
 		case CTRL('s'):
 			dir = +1;
+			/* the next match may overlap this one, as counted */
 			if (buf->match_end)
-				search_point = buf->match_end + 1;
+				search_point = buf->match_start + 1;
 			break;
 		case CTRL('r'):
 			dir = -1;
@@ -1510,6 +3816,7 @@ isearch(View *view, int dir)
 				term[l] = ch;
 				term[l+1] = 0;
 			} else if (ch > 0) {
+				count_cancel();
 				buf->mark = text_mark_set(buf->text, initial_point);
 				message("Mark saved where search started");
 				buf->match_start = buf->match_end = 0;
@@ -1523,14 +3830,29 @@ isearch(View *view, int dir)
 		size_t found;
 again:
 		if (strlen(term) > 0) {
+			/* an unfinished count for another term is useless */
+			if (strcmp(count.term, term) != 0)
+				count_cancel();
+
 			if (dir == +1)
-				found = text_find_next(buf->text, search_point, term);
+				search_start(buf->text, 0, term, dir,
+				    search_point, text_size(buf->text), 0);
 			else
-				found = text_find_prev(buf->text, search_point, term);
+				search_start(buf->text, 0, term, dir,
+				    0, search_point, 0);
+
+			/* typing on makes the result stale */
+			isearch_prompt(prompt, sizeof prompt, failed, dir, term,
+			    buf->match_start);
+			if ((pending = search_wait(prompt)) != ERR) {
+				search_cancel();
+				continue;
+			}
 
-			if (found == search_point) {
+			found = search.found;
+			if (found == EPOS) {
 				if (!failed) {
-					flash();
+					command_failed();
 					failed = 1;
 				} else {
 					search_point = dir == +1 ? 0 :
@@ -1544,6 +3866,7 @@ again:
 				buf->match_end = found + strlen(term);
 				buf->point = text_mark_set(buf->text, buf->match_end);
 				update_target_column(buf);
+				count_start(buf->text, term);
 			}
 		} else {
 			buf->match_start = buf->match_end = 0;
@@ -1556,6 +3879,198 @@ again:
 	}
 }
 
+/* count the newlines in [from, to) */
+static size_t
+count_newlines(Text *txt, size_t from, size_t to)
+{
+	size_t lines = 0;
+
+	for (Iterator it = text_iterator_get(txt, from);
+	    text_iterator_valid(&it) && it.pos < to;
+	    text_iterator_next(&it)) {
+		const char *s = it.text;
+		const char *end = it.end;
+		if ((size_t)(end - s) > to - it.pos)
+			end = s + (to - it.pos);
+
+		while ((s = memchr(s, '\n', end - s))) {
+			lines++;
+			s++;
+		}
+	}
+
+	return lines;
+}
+
+#define OCCUR_LINE_MAX 1024
+
+void
+occur(View *view)
+{
+	Buffer *buf = view->buf;
+
+	static char search_term[1024];
+
+	char *answer = minibuffer_read(view, "List lines matching regexp:",
+	    search_term);
+	if (!answer)
+		return;
+	if (*answer)
+		strcpy(search_term, answer);
+
+	buf->last_action = ACTION_OTHER;
+
+	pcre2_code *re = re_compile(search_term);
+	if (!re)
+		return;
+
+	Text *results = text_load(0);
+	if (!results)
+		return;
+
+	Array matches;
+	array_init_sized(&matches, sizeof (Filerange));
+
+	/* one pass over the buffer, counting lines as we go */
+	size_t size = text_size(buf->text);
+	size_t lineno = 1, counted = 0;
+	size_t pos = 0;
+	char line[OCCUR_LINE_MAX];
+	Filerange match;
+	int rc = PCRE2_ERROR_NOMATCH;
+
+	while (pos < size &&
+	    (rc = re_search_text(buf->text, re, pos, size, 0, &match, 0)) > 0) {
+		size_t bol = text_line_begin(buf->text, match.start);
+		size_t eol = text_line_end(buf->text, match.start);
+
+		lineno += count_newlines(buf->text, counted, bol);
+		counted = bol;
+
+		size_t len = text_bytes_get(buf->text, bol,
+		    MIN(eol - bol, sizeof line), line);
+		text_appendf(results, "%7zu:", lineno);
+		text_insert(results, text_size(results), line, len);
+		text_appendf(results, "%s\n", eol - bol > len ? "..." : "");
+
+		if (!array_add(&matches, &match))
+			break;
+
+		pos = eol + 1;  /* one entry per line */
+	}
+
+	size_t n = array_length(&matches);
+
+	if (rc < 0 && rc != PCRE2_ERROR_NOMATCH) {
+		alert("PCRE2 error %d", rc);
+	} else if (n == 0) {
+		message("No matches for \"%s\"", search_term);
+	} else {
+		text_printf(results, 0, "%zu match%s for \"%s\" in buffer %s\n",
+		    n, n == 1 ? "" : "es", search_term, buf->name);
+		text_saved(results, 0);  /* nothing to save */
+
+		Buffer occur_buf = {
+			.name = "*Occur*",
+			.text = results,
+		};
+		occur_buf.point = occur_buf.mark =
+		    text_mark_set(results, text_pos_by_lineno(results, 2));
+
+		size_t saved_top = view->top;
+		size_t saved_end = view->end;
+		view->buf = &occur_buf;
+		view->top = 0;
+
+		int done = 0;
+		while (!done) {
+			view_render(view);
+			message("");
+
+			int ch = getch();
+			switch (ch) {
+			case 'n':
+			case CTRL('n'):
+			case KEY_DOWN:
+				move_line(view, +1);
+				break;
+			case 'p':
+			case CTRL('p'):
+			case KEY_UP:
+				move_line(view, -1);
+				break;
+			case ' ':
+			case CTRL('v'):
+			case KEY_NPAGE:
+				view_scroll(view, view->lines-1-2);
+				break;
+			case KEY_BACKSPACE:
+			case KEY_DEL:
+			case KEY_PPAGE:
+				view_scroll(view, -((int)view->lines-1-2));
+				break;
+			case '<':
+			case KEY_HOME:
+				beginning_of_buffer(view);
+				break;
+			case '>':
+			case KEY_END:
+				end_of_buffer(view);
+				break;
+			case CTRL('l'):
+				clearok(curscr, TRUE);
+				recenter(view);
+				break;
+			case CTRL('j'):
+			case CTRL('m'):
+				{
+					size_t point = text_mark_get(results,
+					    occur_buf.point);
+					size_t entry = text_lineno_by_pos(results,
+					    point);
+					Filerange *m = entry < 2 ? NULL :
+					    array_get(&matches, entry - 2);
+					if (!m) {
+						alert("No occurrence on this line");
+						break;
+					}
+
+					view->buf = buf;
+					view->top = saved_top;
+					view->end = saved_end;
+
+					buf->point = text_mark_set(buf->text, m->start);
+					buf->match_start = m->start;
+					buf->match_end = m->end;
+					update_target_column(buf);
+
+					if (m->start < view->top || m->start > view->end)
+						recenter(view);
+
+					done = 1;
+				}
+				break;
+			case 'q':
+			case CTRL('g'):
+				view->buf = buf;
+				view->top = saved_top;
+				view->end = saved_end;
+				done = 1;
+				break;
+			case KEY_RESIZE:
+				windows_fit(view);
+				break;
+			default:
+				alert("Buffer is read-only: %s", occur_buf.name);
+				break;
+			}
+		}
+	}
+
+	array_release(&matches);
+	text_free(results);
+}
+
 void
 shell_command(View *view)
 {
@@ -1584,6 +4099,7 @@ shell_command(View *view)
 		}
 	}
 
+	input_modes(0);
 	endwin();
 	fprintf(stderr, "\n\n");
 
@@ -1594,6 +4110,7 @@ shell_command(View *view)
 	fprintf(stderr, "\nPress ENTER or type command to continue");
 
 	raw();
+	input_modes(1);
 	int ch = getch();
 	message("ch=%d", ch);
 	if (ch != ERR && ch != 13)
@@ -1604,66 +4121,592 @@ shell_command(View *view)
 	buf->last_action = ACTION_OTHER;
 }
 
+/* Batch mode: te -batch [-j N] script file... runs the commands of
+   script on each file, without a terminal.  A line of the script is a
+   command and its arguments, words or "strings" with \n, \t, \" and
+   \\ in them; lines starting with # are comments.
+
+	goto-line N
+	re-search-forward REGEXP     point after the match
+	replace-regexp REGEXP TO     from point on, \& and \1..\9 in TO
+	kill-line [N]                as C-k, or C-u N C-k
+	insert STRING
+	yank
+	save
+
+   The commands work on a Buffer as the keys do, and a file the
+   script fails on, say because a search finds nothing, is left as it
+   was last saved.  With -j N, N threads take the files in turn, each
+   with a Text, kill ring and compiled regexp of its own. */
+
+typedef struct {
+	enum {
+		BATCH_GOTO_LINE,
+		BATCH_SEARCH,
+		BATCH_REPLACE,
+		BATCH_KILL_LINE,
+		BATCH_INSERT,
+		BATCH_YANK,
+		BATCH_SAVE
+	} op;
+	char *arg[2];
+	long n;
+	int line;               /* of the script, for errors */
+} BatchCommand;
+
+/* what the arguments are: n a number, N an optional one, r a regexp
+   and s a string */
+static const struct {
+	const char *name;
+	int op;
+	const char *args;
+} batch_commands[] = {
+	{ "goto-line", BATCH_GOTO_LINE, "n" },
+	{ "re-search-forward", BATCH_SEARCH, "r" },
+	{ "replace-regexp", BATCH_REPLACE, "rs" },
+	{ "kill-line", BATCH_KILL_LINE, "N" },
+	{ "insert", BATCH_INSERT, "s" },
+	{ "yank", BATCH_YANK, "" },
+	{ "save", BATCH_SAVE, "" },
+};
+
+static struct {
+	const char *script;
+	BatchCommand *cmd;
+	int n;
+	char **file;
+	int nfile;
+	atomic_int next;        /* file a thread takes next */
+	atomic_int failed;
+} batch;
+
+/* Split off the next word or "string" of the line at *s, or return 0
+   at its end.  *s becomes 0 if a string is not closed. */
+static char *
+batch_word(char **s)
+{
+	char *p = *s + strspn(*s, " \t\n"), *w = p, *t;
+
+	if (!*p)
+		return 0;
+	if (*p != '"') {
+		p += strcspn(p, " \t\n");
+		if (*p)
+			*p++ = 0;
+		*s = p;
+		return w;
+	}
+
+	for (w = t = ++p; *p && *p != '"'; p++) {
+		if (*p == '\\' && p[1]) {
+			switch (*++p) {
+			case 'n': *t++ = '\n'; break;
+			case 't': *t++ = '\t'; break;
+			case '"':
+			case '\\': *t++ = *p; break;
+			default:  /* left for the regexp */
+				*t++ = '\\';
+				*t++ = *p;
+			}
+		} else {
+			*t++ = *p;
+		}
+	}
+	if (!*p) {
+		*s = 0;
+		return 0;
+	}
+	*t = 0;
+	*s = p + 1;
+	return w;
+}
+
+static int
+batch_error(int line, const char *what, const char *arg)
+{
+	fprintf(stderr, "te: %s:%d: %s%s\n", batch.script, line, what, arg);
+	return 0;
+}
+
+/* Read the commands of batch.script */
+static int
+batch_parse(void)
+{
+	FILE *f = strcmp(batch.script, "-") == 0 ? stdin :
+	    fopen(batch.script, "r");
+	char *line = 0, *s, *w;
+	size_t size = 0;
+	int lineno = 0, ok = 1;
+
+	if (!f) {
+		fprintf(stderr, "te: %s: %s\n", batch.script, strerror(errno));
+		return 0;
+	}
+
+	while (ok && getline(&line, &size, f) > 0) {
+		lineno++;
+		s = line;
+		if (!(w = batch_word(&s)) || *w == '#')
+			continue;
+
+		size_t i;
+		for (i = 0; i < sizeof batch_commands / sizeof batch_commands[0]; i++)
+			if (strcmp(w, batch_commands[i].name) == 0)
+				break;
+		if (i == sizeof batch_commands / sizeof batch_commands[0]) {
+			ok = batch_error(lineno, "unknown command ", w);
+			break;
+		}
+
+		BatchCommand *cmd = realloc(batch.cmd,
+		    (batch.n + 1) * sizeof *cmd);
+		if (!cmd) {
+			ok = batch_error(lineno, strerror(errno), "");
+			break;
+		}
+		batch.cmd = cmd;
+		cmd += batch.n++;
+		*cmd = (BatchCommand){ .op = batch_commands[i].op, .line = lineno };
+
+		int nargs = 0;
+		for (const char *a = batch_commands[i].args; *a && ok; a++) {
+			char *end;
+			if (!(w = batch_word(&s))) {
+				if (*a != 'N')
+					ok = batch_error(lineno, s ?
+					    "missing argument" : "unterminated string", "");
+				break;
+			}
+			switch (*a) {
+			case 'n':
+			case 'N':
+				cmd->n = strtol(w, &end, 10);
+				if (!*w || *end)
+					ok = batch_error(lineno, "not a number: ", w);
+				break;
+			case 'r':
+				if (!re_compile(w)) {
+					message_buf[strcspn(message_buf, "\n")] = 0;
+					ok = batch_error(lineno, message_buf, "");
+				}
+				/* fall through */
+			case 's':
+				if (!(cmd->arg[nargs++] = strdup(w)))
+					ok = batch_error(lineno, strerror(errno), "");
+			}
+		}
+		if (ok && s && batch_word(&s))
+			ok = batch_error(lineno, "too many arguments", "");
+		else if (ok && !s)
+			ok = batch_error(lineno, "unterminated string", "");
+	}
+
+	if (ok && ferror(f))
+		ok = batch_error(lineno, strerror(errno), "");
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	return ok;
+}
+
+/* Search the regexp term from pos on, like C-M-s */
+static int
+batch_search(Text *txt, const char *term, size_t pos, uint32_t options,
+    Filerange *match)
+{
+	pcre2_code *re = re_compile(term);
+	if (!re)
+		return PCRE2_ERROR_NOMEMORY;
+
+	int rc = re_search_text(txt, re, pos, text_size(txt), options, match, 0);
+	if (rc == PCRE2_ERROR_NOMATCH)
+		message("Search failed: %s", term);
+	else if (rc < 0)
+		message("PCRE2 error %d", rc);
+	return rc;
+}
+
+/* matches closer than this are replaced together, by one edit of the
+   text from the first to the last with all that is between them */
+#define BATCH_REPLACE_GAP 4096
+#define BATCH_REPLACE_RUN (1 << 20)
+
+/* Append n bytes to the buffer at *s, from txt at pos or else from t */
+static int
+batch_append(char **s, size_t *len, size_t *size, Text *txt, size_t pos,
+    const char *t, size_t n)
+{
+	if (*len + n > *size) {
+		size_t more = MAX(2 * *size, *len + n + 4096);
+		char *p = realloc(*s, more);
+		if (!p) {
+			message("%s", strerror(errno));
+			return 0;
+		}
+		*s = p;
+		*size = more;
+	}
+	if (t)
+		memcpy(*s + *len, t, n);
+	else
+		text_bytes_get(txt, pos, n, *s + *len);
+	*len += n;
+	return 1;
+}
+
+/* Replace the matches of term after point with to, where \& stands
+   for the match, \1 to \9 for its groups and \\ for a backslash */
+static int
+batch_replace(Buffer *buf, const char *term, const char *to)
+{
+	Text *txt = buf->text;
+	size_t pos = text_mark_get(txt, buf->point);
+	size_t start = pos;     /* the text up to pos is replaced by s */
+	uint32_t options = 0;
+	char *s = 0;
+	size_t len = 0, size = 0;
+	int rc, ok = 1, replaced = 0;
+	Filerange match;
+
+	record_undo(buf);
+	for (;;) {
+		rc = batch_search(txt, term, pos, options, &match);
+		if (len > 0 && (rc <= 0 || len > BATCH_REPLACE_RUN ||
+		    match.start - pos > BATCH_REPLACE_GAP)) {
+			text_delete(txt, start, pos - start);
+			text_insert(txt, start, s, len);
+			if (rc > 0) {  /* where the match moved to */
+				match.start += start + len - pos;
+				match.end += start + len - pos;
+			}
+			pos = start + len;
+			len = 0;
+		}
+		if (rc <= 0)
+			break;
+		if (len == 0)
+			start = pos = match.start;
+		ok = batch_append(&s, &len, &size, txt, pos, 0, match.start - pos);
+
+		size_t *ovector = pcre2_get_ovector_pointer(re_cache.match_data);
+		for (const char *p = to; ok && *p; p++) {
+			if (*p == '\\' && (p[1] == '&' || isdigit((unsigned char)p[1]))) {
+				int group = *++p == '&' ? 0 : *p - '0';
+				if (group < rc && ovector[2*group] != PCRE2_UNSET)
+					ok = batch_append(&s, &len, &size, txt,
+					    match.start - ovector[0] + ovector[2*group],
+					    0, ovector[2*group+1] - ovector[2*group]);
+			} else {
+				if (*p == '\\' && p[1] == '\\')
+					p++;
+				ok = batch_append(&s, &len, &size, txt, 0, p, 1);
+			}
+		}
+		if (!ok)
+			break;
+
+		pos = match.end;
+		/* an empty match is not found at the same place again */
+		options = match.start == match.end ? PCRE2_NOTEMPTY_ATSTART : 0;
+		replaced = 1;
+	}
+	free(s);
+
+	if (replaced)
+		buf->point = text_mark_set(txt, pos);
+	buf->last_action = ACTION_OTHER;
+	return ok && rc == PCRE2_ERROR_NOMATCH;
+}
+
+static int
+batch_command(Buffer *buf, const BatchCommand *cmd)
+{
+	Text *txt = buf->text;
+	size_t point = text_mark_get(txt, buf->point);
+	Filerange match;
+
+	switch (cmd->op) {
+	case BATCH_GOTO_LINE:
+		point = cmd->n <= 0 ? 0 : text_pos_by_lineno(txt, cmd->n);
+		if (point == EPOS)
+			point = text_size(txt);
+		buf->point = text_mark_set(txt, point);
+		break;
+	case BATCH_SEARCH:
+		if (batch_search(txt, cmd->arg[0], point,
+		    point == 0 ? 0 : PCRE2_NOTEMPTY_ATSTART, &match) <= 0)
+			return 0;
+		buf->match_start = match.start;
+		buf->match_end = match.end;
+		buf->point = text_mark_set(txt, match.end);
+		break;
+	case BATCH_REPLACE:
+		return batch_replace(buf, cmd->arg[0], cmd->arg[1]);
+	case BATCH_KILL_LINE:
+		kill_eol(buf, cmd->n);
+		return 1;  /* C-k after C-k appends */
+	case BATCH_INSERT:
+		insert_chars(buf, cmd->arg[0], strlen(cmd->arg[0]), 1);
+		return 1;
+	case BATCH_YANK:
+		yank(buf);
+		return 1;
+	case BATCH_SAVE:
+		if (!text_save_method(txt, buf->file, TEXT_SAVE_ATOMIC)) {
+			message("Saving failed: %s", strerror(errno));
+			return 0;
+		}
+		break;
+	}
+
+	buf->last_action = ACTION_OTHER;
+	return 1;
+}
+
+/* Run the script on file, in a buffer of its own.  The kill ring is
+   emptied after, so kills refer to no file longer than needed. */
+static int
+batch_file(const char *file)
+{
+	Buffer buf = { .file = file, .name = file };
+	int ok = 1;
+
+	errno = 0;
+	if (!(buf.text = text_load(file))) {
+		fprintf(stderr, "te: %s: %s\n", file,
+		    errno ? strerror(errno) : "cannot load");
+		return 0;
+	}
+	buf.point = buf.mark = text_mark_set(buf.text, 0);
+
+	for (int i = 0; ok && i < batch.n; i++)
+		if (!(ok = batch_command(&buf, &batch.cmd[i])))
+			fprintf(stderr, "te: %s: %s:%d: %s\n", file,
+			    batch.script, batch.cmd[i].line, message_buf);
+
+	text_free(buf.text);
+	while (killring.n > 0)
+		killring_drop_oldest();
+	return ok;
+}
+
+static void *
+batch_thread(void *arg)
+{
+	int i;
+
+	(void)arg;
+	while ((i = atomic_fetch_add(&batch.next, 1)) < batch.nfile)
+		if (!batch_file(batch.file[i]))
+			atomic_store(&batch.failed, 1);
+
+	pcre2_match_data_free(re_cache.match_data);
+	pcre2_code_free(re_cache.re);
+	re_cache.re = 0;
+	re_cache.match_data = 0;
+	return 0;
+}
+
+/* te -batch [-j N] script file... */
+static int
+batch_main(int argc, char *argv[])
+{
+	long jobs = 1;
+	char *end;
+
+	if (argc > 0 && strncmp(argv[0], "-j", 2) == 0) {
+		int shift = argv[0][2] ? 1 : 2;  /* -jN or -j N */
+		const char *n = shift == 1 ? argv[0] + 2 : argc > 1 ? argv[1] : "";
+		jobs = strtol(n, &end, 10);
+		if (!*n || *end || jobs < 1) {
+			fprintf(stderr, "te: -j wants a number of threads\n");
+			return 2;
+		}
+		argc -= shift;
+		argv += shift;
+	}
+	if (argc < 1) {
+		fprintf(stderr, "usage: te -batch [-j N] script file...\n");
+		return 2;
+	}
+
+	batch.script = argv[0];
+	batch.file = argv + 1;
+	batch.nfile = argc - 1;
+	if (!batch_parse())
+		return 2;
+
+	/* this thread is one of the workers */
+	pthread_t *threads = calloc(MIN(jobs, batch.nfile), sizeof *threads);
+	int n = 0;
+	while (threads && n + 1 < MIN(jobs, batch.nfile) &&
+	    pthread_create(&threads[n], 0, batch_thread, 0) == 0)
+		n++;
+	batch_thread(0);
+	while (n > 0)
+		pthread_join(threads[--n], 0);
+	free(threads);
+
+	return atomic_load(&batch.failed) ? 1 : 0;
+}
+
+/* Read the prefix argument that C-u, maybe repeated, or M-digit or
+   M-- start, with the digits after it.  Returns the key of the command
+   it is for. */
+static int
+prefix_argument(View *view, int ch, long *arg)
+{
+	long n = 0, times4 = ch == CTRL('u');
+	int sign = 1, digits = 0;
+	int key = ch == CTRL('u') ? ERR : getch();
+
+	for (;;) {
+		if (key == CTRL('[')) {  /* M-digit after M-digit */
+			key = getch();
+			if (!isdigit(key)) {
+				ungetch(key);
+				key = CTRL('[');
+				break;
+			}
+		}
+		if (key == ERR) {
+			;
+		} else if (isdigit(key)) {
+			if (n < INT_MAX / 10)
+				n = n * 10 + key - '0';
+			digits = 1;
+		} else if (key == '-' && !digits && sign > 0) {
+			sign = -1;
+		} else if (key == CTRL('u') && !digits && sign > 0) {
+			times4++;
+		} else if (key == CTRL('u')) {
+			key = getch();  /* taken as it is, even a digit */
+			break;
+		} else {
+			break;
+		}
+
+		if (digits)
+			message("C-u %ld-", sign * n);
+		else if (sign < 0)
+			message("C-u -");
+		else
+			message("C-u %ld-", 1L << (2 * times4));
+
+		nodelay(stdscr, TRUE);
+		key = getch();
+		nodelay(stdscr, FALSE);
+		if (key == ERR) {
+			view_render(view);
+			key = getch();
+		}
+	}
+
+	if (digits)
+		*arg = sign * n;
+	else if (sign < 0)
+		*arg = -1;
+	else
+		*arg = 1L << (2 * MIN(times4, 15));
+	message("");
+	return key;
+}
+
 int
 main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "");  // XXX force UTF-8 somehow for ncurses to work
 	message("");
 
-	killring = text_load(0);
+	if (argc > 1 && strcmp(argv[1], "-batch") == 0)
+		return batch_main(argc - 2, argv + 2);
 
-	const char *file = argc == 2 ? argv[1] : "README.md";
-	Text *text = text_load(file);
-	if (!text) {
-		text = text_load(0);
-		if (errno == ENOENT)
-			message("(New file)");
-		else
-			alert("Error opening %s: %s", file, strerror(errno));
-	}
-	Buffer *buf = malloc (sizeof *buf);
-	View *view = malloc (sizeof *view);
+	for (int i = 1; i < argc; i++)
+		buffer_new(argv[i], 0);
+	if (!buffers)
+		buffer_new("README.md", 0);
+	Buffer *buf = buffers;
+	View *view = calloc (1, sizeof *view);
 
-	buf->file = file;
-	buf->name = strrchr(file, '/');
-	if (buf->name)
-		buf->name++;
-	else
-		buf->name = file;
-	buf->text = text;
-	buf->point = buf->mark = text_mark_set(text, 0);
-	buf->target_column = 0;
-	buf->match_start = buf->match_end = 0;
+	buffer_load(buf);
 
+#ifdef TE_VT
+	vt_init();
+#else
 	initscr();
 	raw();
 	noecho();
 	nonl();
-	keypad(stdscr, TRUE);
-	meta(stdscr, TRUE);
+	idlok(stdscr, TRUE);  /* view_render scrolls */
+#endif
+	input_init();
 
 	window_title(buf->name);
-
-	/* remove mapping of ^H to backspace, unless ^H is actually set
-	   as erase character.  This hack is required because many
-	   terminfo entries set kbs=^H even if ^? is send by the terminal. */
-	if (erasechar() != CTRL('h'))
-		define_key("\b", CTRL('h'));
+	input_modes(1);
 
 	view->buf = buf;
 	view->top = 0;
 	view->end = 0;
-	getmaxyx(stdscr, view->lines, view->cols);
+	view->rows = 0;
+	view->nrows = 0;
+	views = view;
+	windows_fit(view);
 
 	int ch = 0;
+	Latency *last = 0;
 	while (!quit) {
-		getmaxyx(stdscr, view->lines, view->cols);
+		windows_fit(view);
 
-		view_render(view);
+		/* keys typed ahead, like a paste, run back to back and only
+		   the screen after the last one is drawn */
+		nodelay(stdscr, TRUE);
+		ch = getch();
+		nodelay(stdscr, FALSE);
+		if (ch == ERR) {
+			unsigned long t = now_us();
+			view_render(view);
+			t = now_us() - t;
+			if (last) {
+				hist_add(&last->render, t - refresh_us);
+				hist_add(&last->refresh, refresh_us);
+				hist_add(&latency_all.render, t - refresh_us);
+				hist_add(&latency_all.refresh, refresh_us);
+				last = 0;
+			}
+			ch = getch();
+		}
 		message("");
 		view->buf->match_start = view->buf->match_end = 0;
 
-		ch = getch();
+		/* the count most commands take */
+		long arg = 1;
+		int have_arg = 0;
+		if (ch == CTRL('[')) {
+			int ch2 = getch();
+			ungetch(ch2);
+			have_arg = isdigit(ch2) || ch2 == '-';
+		}
+		if (ch == CTRL('u') || have_arg) {
+			ch = prefix_argument(view, ch, &arg);
+			have_arg = 1;
+		}
+
+		/* the command is named by its keys, including the one after
+		   a prefix key */
+		char keys[32];
+		if ((0x20 <= ch && ch < 0x7f) || (0x80 <= ch && ch <= 0xff))
+			snprintf(keys, sizeof keys, "self-insert");
+		else
+			snprintf(keys, sizeof keys, "%s",
+			    keyname(ch) ? keyname(ch) : "?");
+		if (ch == CTRL('x') || ch == CTRL('[')) {
+			int ch2 = getch();
+			snprintf(keys + strlen(keys), sizeof keys - strlen(keys),
+			    " %s", keyname(ch2) ? keyname(ch2) : "?");
+			ungetch(ch2);
+		}
+		unsigned long command_start = now_us();
+
 		switch (ch) {
 		case CTRL(' '):
 			set_mark(view->buf);
@@ -1673,21 +4716,21 @@ main(int argc, char *argv[])
 			break;
 		case CTRL('b'):
 		case KEY_LEFT:
-			move_char(view->buf, -1);
+			move_char(view->buf, -arg);
 			break;
 		case CTRL('c'):
 			quit = 1;
 			break;
 		case CTRL('d'):
 		case KEY_DC:
-			delete(view->buf);
+			delete(view->buf, arg);
 			break;
 		case CTRL('e'):
 			move_eol(view->buf);
 			break;
 		case CTRL('f'):
 		case KEY_RIGHT:
-			move_char(view->buf, +1);
+			move_char(view->buf, +arg);
 			break;
 		case CTRL('g'):
 			alert("Quit");
@@ -1697,25 +4740,25 @@ main(int argc, char *argv[])
 			break;
 		case CTRL('j'):
 		case CTRL('m'):
-			insert_char(view->buf, '\n');
+			insert_chars(view->buf, "\n", 1, arg);
 			break;
 		case CTRL('k'):
-			kill_eol(view->buf);
+			kill_eol(view->buf, have_arg ? arg : 0);
 			break;
 		case CTRL('l'):
-			clear();
+			clearok(curscr, TRUE);
 			recenter(view);
 			break;
 		case CTRL('n'):
 		case KEY_DOWN:
-			move_line(view, +1);
+			move_line(view, +arg);
 			break;
 		case CTRL('o'):
 			open_line(view->buf);
 			break;
 		case CTRL('p'):
 		case KEY_UP:
-			move_line(view, -1);
+			move_line(view, -arg);
 			break;
 		case CTRL('q'):
 			quoted_insert(view->buf);
@@ -1731,10 +4774,10 @@ main(int argc, char *argv[])
 			break;
 		case CTRL('v'):
 		case KEY_NPAGE:
-			view_scroll(view, view->lines-2-2);
+			view_scroll(view, have_arg ? arg : view->lines-1-2);
 			break;
 		case KEY_PPAGE:
-			view_scroll(view, -((int)view->lines-2-2));
+			view_scroll(view, have_arg ? -arg : -((int)view->lines-1-2));
 			break;
 		case CTRL('w'):
 			kill_region(view->buf);
@@ -1750,7 +4793,7 @@ main(int argc, char *argv[])
 			break;
 		case KEY_BACKSPACE:
 		case KEY_DEL:
-			backspace(view->buf);
+			backspace(view->buf, arg);
 			break;
 		case KEY_HOME:
 			beginning_of_buffer(view);
@@ -1762,18 +4805,63 @@ main(int argc, char *argv[])
 			{
 				int ch2 = getch();
 				switch(ch2) {
+				case '0':
+					view = delete_window(view);
+					break;
+				case '1':
+					delete_other_windows(view);
+					break;
+				case '2':
+					split_window(view, 0);
+					break;
+				case '3':
+					split_window(view, 1);
+					break;
+				case '(':
+					start_kbd_macro();
+					break;
+				case ')':
+					end_kbd_macro();
+					break;
 				case '8':
 					insert_byte(view);
 					break;
+				case 'e':
+					if (arg < 0)
+						alert("Negative repetition argument");
+					else
+						call_last_kbd_macro(arg);
+					break;
 				case 'g':
 					goto_line(view);
 					break;
+				case 'o':
+					view = other_window(view);
+					break;
+				case 't':
+					latency_show();
+					break;
+				case '=':
+					text_stats_show(view);
+					break;
 				case 'u':
 					undo(view->buf);
 					break;
+				case 'x':
+					if (getch() == 't')
+						toggle_truncate_lines(view);
+					else
+						message("unknown key C-x x");
+					break;
+				case 'b':
+					switch_to_buffer(view);
+					break;
 				case CTRL('c'):
 					want_quit(view);
 					break;
+				case CTRL('f'):
+					find_file(view);
+					break;
 				case CTRL('g'):
 					alert("Quit");
 					break;
@@ -1811,11 +4899,11 @@ main(int argc, char *argv[])
 					break;
 				case '{':
 				kUP5:
-					move_paragraph(view->buf, -1);
+					move_paragraph(view->buf, -arg);
 					break;
 				case '}':
 				kDN5:
-					move_paragraph(view->buf, +1);
+					move_paragraph(view->buf, +arg);
 					break;
 				case CTRL('g'):
 					alert("Quit");
@@ -1828,33 +4916,43 @@ main(int argc, char *argv[])
 					break;
 				case 'b':
 				kLFT5:
-					backward_word(view->buf);
+					backward_word(view->buf, arg);
 					break;
 				case 'c':
 					capitalize_word(view->buf);
 					break;
 				case 'd':
-					kill_word(view->buf);
+					kill_word(view->buf, arg);
 					break;
 				case 'f':
 				kRIT5:
-					forward_word(view->buf);
+					forward_word(view->buf, arg);
 					break;
 				case 'g':
 					goto_line(view);
 					break;
 				case 'v':
-					view_scroll(view, -(view->lines-2-2));
+					view_scroll(view,
+					    have_arg ? -arg : -(view->lines-1-2));
+					break;
+				case 's':
+					{
+						int ch3 = getch();
+						if (ch3 == 'o')
+							occur(view);
+						else
+							message("unknown key M-s %d", ch3);
+					}
 					break;
 				case 'w':
 					kill_region_save(view);
 					break;
 				case 'y':
-					yank_pop(buf);
+					yank_pop(view->buf);
 					break;
 				case KEY_BACKSPACE:
 				case KEY_DEL:
-					backward_kill_word(view->buf);
+					backward_kill_word(view->buf, arg);
 					break;
 				default:
 					message("unknown key M-%d %s",
@@ -1863,46 +4961,55 @@ main(int argc, char *argv[])
 				}
 			}
 			break;
+		case KEY_C_UP:
+			goto kUP5;
+		case KEY_C_DOWN:
+			goto kDN5;
+		case KEY_C_LEFT:
+			goto kLFT5;
+		case KEY_C_RIGHT:
+			goto kRIT5;
+		case KEY_PASTE:
+			paste(view->buf);
+			break;
 		case KEY_RESIZE:
-			/* ignore */
+#ifndef TE_VT
+			refresh();  /* curses takes the new size */
+#endif
 			break;
 		default:
-			if (ch > KEY_MAX) {
-				const char *name = keyname(ch);
-				if (!name)
-					goto unknown;
-				if (strcmp(name, "kUP5") == 0)
-					goto kUP5;
-				else if (strcmp(name, "kDN5") == 0)
-					goto kDN5;
-				else if (strcmp(name, "kLFT5") == 0)
-					goto kLFT5;
-				else if (strcmp(name, "kRIT5") == 0)
-					goto kRIT5;
-				else
-					goto unknown;
-			} else if (0x20 <= ch && ch < 0x7f) {
-				insert_char(view->buf, ch);
+			if (0x20 <= ch && ch < 0x7f) {
+				const char c = ch;
+				insert_chars(view->buf, &c, 1, arg);
 			} else if (ch >= 0x80 && ch <= 0xff && ISUTF8(ch)) {
-				insert_char(view->buf, ch);
-				nodelay(stdscr, TRUE);
-				int ch2;
-				while ((ch2 = getch()) != ERR) {
-					if (!ISUTF8(ch2))
-						insert_char(view->buf, ch2);
-					else
+				char c[4] = { ch };
+				size_t len = 1;
+				/* the rest of the character, which can come
+				   later than its first byte */
+				int more = ch >= 0xf0 ? 3 : ch >= 0xe0 ? 2 : 1;
+				while (more-- > 0) {
+					int ch2 = getch();
+					if (ISUTF8(ch2)) {
 						ungetch(ch2);
+						break;
+					}
+					c[len++] = ch2;
 				}
-				nodelay(stdscr, FALSE);
-
+				insert_chars(view->buf, c, len, arg);
 			} else {
-			unknown:
 				alert("unknown key %d %s", ch, keyname(ch));
 			}
 			break;
 		}
+
+		unsigned long t = now_us() - command_start;
+		if ((last = latency_get(keys)))
+			hist_add(&last->command, t);
+		hist_add(&latency_all.command, t);
 	}
 
+	latency_dump();
+	input_modes(0);
 	endwin();
 	window_title(0);
 
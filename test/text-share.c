@@ -0,0 +1,97 @@
+/* text-share - texts taking data from others by text_insert_text
+
+   text-share
+
+   Checks what killing and yanking by reference does to the text
+   killed from, as te does it: to its pieces and to its marks.  Prints
+   each failed check and exits with status 1 if there was one. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../vis/text.h"
+
+static int failed;
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1; \
+	} \
+} while (0)
+
+static Text *
+text_with(const char *s)
+{
+	Text *txt = text_load(NULL);
+	if (txt)
+		text_insert(txt, 0, s, strlen(s));
+	return txt;
+}
+
+/* typing after a kill still extends the last changed piece */
+static void
+type_after_kill(void)
+{
+	Text *buf = text_with("hello world\n");
+	Text *kill = text_load(NULL);
+
+	text_snapshot(buf);
+	check(text_insert_text(kill, 0, buf, 0, 6));
+	check(text_delete(buf, 0, 6));
+	text_snapshot(buf);
+
+	TextStats before = text_stats(buf);
+	for (size_t i = 0; i < 1000; i++)
+		check(text_insert(buf, 5 + i, "x", 1));
+	TextStats after = text_stats(buf);
+
+	check(after.pieces - before.pieces <= 2);
+	check(after.changes - before.changes <= 1);
+	check(text_size(buf) == 1006);
+
+	text_free(kill);
+	text_free(buf);
+}
+
+/* a mark on killed text follows it to where it is yanked, and back */
+static void
+mark_on_kill(void)
+{
+	Text *buf = text_with("hello world\n");
+	Text *kill = text_load(NULL);
+	char s[16];
+
+	text_snapshot(buf);
+	Mark mark = text_mark_set(buf, 6);
+	check(text_insert_text(kill, 0, buf, 6, 5));
+	check(text_delete(buf, 6, 5));
+	text_snapshot(buf);
+	check(text_mark_get(buf, mark) == EPOS);
+
+	check(text_insert_text(buf, 0, kill, 0, 5));
+	text_snapshot(buf);
+	check(text_mark_get(buf, mark) == 0);
+	check(text_bytes_get(buf, 0, 12, s) == 12 && !memcmp(s, "worldhello \n", 12));
+
+	text_undo(buf);
+	check(text_mark_get(buf, mark) == EPOS);
+	text_undo(buf);
+	check(text_mark_get(buf, mark) == 6);
+	check(text_bytes_get(buf, 0, 12, s) == 12 && !memcmp(s, "hello world\n", 12));
+
+	/* shown twice, the second is a copy */
+	check(text_insert_text(buf, 0, kill, 0, 5));
+	check(text_mark_get(buf, mark) == 11);
+
+	text_free(kill);
+	text_free(buf);
+}
+
+int
+main(void)
+{
+	type_after_kill();
+	mark_on_kill();
+	return failed;
+}
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "text.h"
+#include "text-internal.h"
 
 static bool text_vprintf(Text *txt, size_t pos, const char *format, va_list ap) {
 	va_list ap_save;
@@ -57,6 +58,7 @@ size_t text_bytes_get(const Text *txt, size_t pos, size_t len, char *buf) {
 			rem -= piece_len;
 		}
 	}
+	text_bytes_counted(txt, len - rem);
 	return len - rem;
 }
 
@@ -17,6 +17,7 @@ typedef struct {
 		BLOCK_TYPE_MMAP,      /* mmap(2)-ed from a temporary file only known to this process */
 		BLOCK_TYPE_MALLOC,    /* heap allocated block using malloc(3) */
 	} type;
+	int refs;                  /* number of Texts holding the block */
 } Block;
 
 Block *block_alloc(size_t size);
@@ -28,8 +29,10 @@ bool block_capacity(Block*, size_t len);
 const char *block_append(Block*, const char *data, size_t len);
 bool block_insert(Block*, size_t pos, const char *data, size_t len);
 bool block_delete(Block*, size_t pos, size_t len);
+void block_stats(size_t *malloc_bytes, size_t *mmap_bytes);
 
 Block *text_block_mmaped(Text*);
 void text_saved(Text*, struct stat *meta);
+void text_bytes_counted(const Text*, size_t len);
 
 #endif
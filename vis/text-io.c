@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
 #if CONFIG_ACL
 #include <sys/acl.h>
@@ -37,6 +38,9 @@ struct TextSave {                  /* used to hold context between text_save_{be
  * results in havoc. */
 #define BLOCK_MMAP_SIZE (1 << 26)
 
+/* bytes held in the blocks of all texts, see text_stats */
+static atomic_size_t malloc_bytes, mmap_bytes;
+
 /* allocate a new block of MAX(size, BLOCK_SIZE) bytes */
 Block *block_alloc(size_t size) {
 	Block *blk = calloc(1, sizeof *blk);
@@ -50,6 +54,8 @@ Block *block_alloc(size_t size) {
 	}
 	blk->type = BLOCK_TYPE_MALLOC;
 	blk->size = size;
+	blk->refs = 1;
+	atomic_fetch_add(&malloc_bytes, size);
 	return blk;
 }
 
@@ -89,6 +95,8 @@ Block *block_mmap(size_t size, int fd, off_t offset) {
 	blk->type = BLOCK_TYPE_MMAP_ORIG;
 	blk->size = size;
 	blk->len = size;
+	blk->refs = 1;
+	atomic_fetch_add(&mmap_bytes, size);
 	return blk;
 }
 
@@ -119,15 +127,21 @@ out:
 }
 
 void block_free(Block *blk) {
-	if (!blk)
+	if (!blk || --blk->refs > 0)
 		return;
 	if (blk->type == BLOCK_TYPE_MALLOC)
 		free(blk->data);
 	else if ((blk->type == BLOCK_TYPE_MMAP_ORIG || blk->type == BLOCK_TYPE_MMAP) && blk->data)
 		munmap(blk->data, blk->size);
+	atomic_fetch_sub(blk->type == BLOCK_TYPE_MALLOC ? &malloc_bytes : &mmap_bytes, blk->size);
 	free(blk);
 }
 
+void block_stats(size_t *heap, size_t *mapped) {
+	*heap = atomic_load(&malloc_bytes);
+	*mapped = atomic_load(&mmap_bytes);
+}
+
 /* check whether block has enough free space to store len bytes */
 bool block_capacity(Block *blk, size_t len) {
 	return blk->size - blk->len >= len;
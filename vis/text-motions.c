@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memmem(3) and memrchr(3) are non-standard */
+#endif
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -74,7 +77,11 @@ static size_t find_next(Text *txt, size_t pos, const char *s, bool line) {
 }
 
 size_t text_find_next(Text *txt, size_t pos, const char *s) {
-	return find_next(txt, pos, s, false);
+	if (!s)
+		return pos;
+	Filerange r = text_range_new(pos, text_size(txt));
+	size_t match = text_find_range_next(txt, &r, s, strlen(s));
+	return match == EPOS ? pos : match;
 }
 
 size_t text_line_find_next(Text *txt, size_t pos, const char *s) {
@@ -106,7 +113,73 @@ static size_t find_prev(Text *txt, size_t pos, const char *s, bool line) {
 }
 
 size_t text_find_prev(Text *txt, size_t pos, const char *s) {
-	return find_prev(txt, pos, s, false);
+	if (!s)
+		return pos;
+	Filerange r = text_range_new(0, pos);
+	size_t match = text_find_range_prev(txt, &r, s, strlen(s));
+	return match == EPOS ? pos : match;
+}
+
+/* compare len bytes starting at pos with s, across piece boundaries */
+static bool match_at(Text *txt, size_t pos, const char *s, size_t len) {
+	for (Iterator it = text_iterator_get(txt, pos);
+	     len > 0 && text_iterator_valid(&it);
+	     text_iterator_next(&it)) {
+		size_t n = MIN(len, (size_t)(it.end - it.text));
+		if (memcmp(it.text, s, n) != 0)
+			return false;
+		s += n;
+		len -= n;
+	}
+	return len == 0;
+}
+
+size_t text_find_range_next(Text *txt, const Filerange *r, const char *s, size_t len) {
+	if (!text_range_valid(r) || len == 0)
+		return EPOS;
+	for (Iterator it = text_iterator_get(txt, r->start);
+	     text_iterator_valid(&it) && it.pos < r->end;
+	     text_iterator_next(&it)) {
+		size_t avail = it.end - it.text;
+		size_t starts = MIN(avail, r->end - it.pos);
+		/* occurrences completely within this piece */
+		size_t hay = MIN(avail, starts + len - 1);
+		const char *match = memmem(it.text, hay, s, len);
+		if (match)
+			return it.pos + (match - it.text);
+		/* occurrences continuing into the next piece */
+		for (size_t off = avail >= len ? avail - len + 1 : 0; off < starts; off++) {
+			if (it.text[off] == s[0] && match_at(txt, it.pos + off, s, len))
+				return it.pos + off;
+		}
+	}
+	return EPOS;
+}
+
+size_t text_find_range_prev(Text *txt, const Filerange *r, const char *s, size_t len) {
+	if (!text_range_valid(r) || len == 0 || text_range_size(r) < len)
+		return EPOS;
+	size_t min = r->start + len - 1; /* lowest position of the last byte */
+	for (Iterator it = text_iterator_get(txt, r->end);
+	     text_iterator_valid(&it);
+	     text_iterator_prev(&it)) {
+		size_t piece_pos = it.pos - (it.text - it.start);
+		const char *lo = it.start, *hi = it.text;
+		if (piece_pos < min)
+			lo += MIN(min - piece_pos, (size_t)(hi - lo));
+		while (hi > lo) {
+			const char *last = memrchr(lo, s[len-1], hi - lo);
+			if (!last)
+				break;
+			size_t start = piece_pos + (last - it.start) - (len - 1);
+			if (match_at(txt, start, s, len))
+				return start;
+			hi = last;
+		}
+		if (piece_pos <= min)
+			break;
+	}
+	return EPOS;
 }
 
 size_t text_line_find_prev(Text *txt, size_t pos, const char *s) {
@@ -27,6 +27,11 @@ size_t text_find_prev(Text*, size_t pos, const char *s);
 /* same as above but limit searched range to the line containing pos */
 size_t text_line_find_next(Text*, size_t pos, const char *s);
 size_t text_line_find_prev(Text*, size_t pos, const char *s);
+/* find the first occurrence of the len bytes at s starting within r,
+ * respectively the last one lying completely within r. Returns EPOS if
+ * there is none. Both scan whole pieces with memmem(3) and memrchr(3). */
+size_t text_find_range_next(Text*, const Filerange *r, const char *s, size_t len);
+size_t text_find_range_prev(Text*, const Filerange *r, const char *s, size_t len);
 
 /*    begin            finish    next
  *    v                v         v
@@ -2,6 +2,14 @@
 #include <string.h>
 
 #include "text-regex.h"
+#include "text-util.h"
+#include "util.h"
+
+/* searches copy at most REGEX_WINDOW bytes of text at a time, a match
+ * ending within REGEX_OVERLAP bytes of the window end is retried in a
+ * window starting at the match, in case it continues beyond it */
+#define REGEX_WINDOW  (1 << 16)
+#define REGEX_OVERLAP (1 << 12)
 
 struct Regex {
 	regex_t regex;
@@ -39,73 +47,133 @@ int text_regex_match(Regex *r, const char *data, int eflags) {
 	return regexec(&r->regex, data, 0, NULL, eflags);
 }
 
-int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
-		return REG_NOMATCH;
-	char *cur = buf, *end = buf + len;
-	int ret = REG_NOMATCH;
+typedef struct {
+	Text *txt;
+	char *buf;     /* NUL terminated copy of [start, start+len) */
+	size_t start;
+	size_t len;
+	size_t end;    /* end of the searched range */
+} Window;
+
+static bool window_init(Window *w, Text *txt, size_t end) {
+	*w = (Window){
+		.txt = txt,
+		.buf = malloc(REGEX_WINDOW + 1),
+		.end = MIN(end, text_size(txt)),
+	};
+	if (!w->buf)
+		return false;
+	w->buf[0] = '\0';
+	return true;
+}
+
+static void window_fill(Window *w, size_t pos) {
+	w->start = pos;
+	w->len = text_bytes_get(w->txt, pos, MIN(REGEX_WINDOW, w->end - pos), w->buf);
+	w->buf[w->len] = '\0';
+}
+
+/* pointer to the byte at pos, refill the window if it is not covered */
+static char *window_get(Window *w, size_t pos) {
+	size_t wend = w->start + w->len;
+	if (pos < w->start || pos > wend || (pos == wend && pos < w->end))
+		window_fill(w, pos);
+	return w->buf + (pos - w->start);
+}
+
+/* Search the NUL terminated segment starting at pos. On success the
+ * whole match is stored in m, otherwise m is set to the range of the
+ * segment including the NUL bytes following it. */
+static int search_segment(Window *w, Regex *r, size_t pos, int eflags, size_t nmatch, RegexMatch pmatch[], Filerange *m) {
 	regmatch_t match[MAX_REGEX_SUB];
-	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
-		ret = regexec(&r->regex, cur, nmatch, match, eflags);
-		if (!ret) {
+	size_t n = MAX(1, MIN(nmatch, MAX_REGEX_SUB));
+	for (;;) {
+		char *cur = window_get(w, pos);
+		char *end = w->buf + w->len;
+		char *seg_end = cur + strlen(cur);
+		bool truncated = seg_end == end && w->start + w->len < w->end;
+		int ret = regexec(&r->regex, cur, n, match, eflags | (truncated ? REG_NOTEOL : 0));
+		if (!ret && (!truncated || cur == w->buf || match[0].rm_eo <= end - cur - REGEX_OVERLAP)) {
 			for (size_t i = 0; i < nmatch; i++) {
 				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
 				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
 			}
-			break;
+			m->start = pos + match[0].rm_so;
+			m->end = pos + match[0].rm_eo;
+			return 0;
+		}
+		if (!truncated) {
+			size_t next = w->start + (seg_end - w->buf);
+			while (next < w->end && !*window_get(w, next))
+				next++;
+			*m = text_range_new(pos, next);
+			return REG_NOMATCH;
+		}
+		/* the segment continues beyond the window, slide it forward */
+		size_t slide;
+		if (!ret)
+			slide = pos + match[0].rm_so;
+		else
+			slide = MAX(pos, w->start + w->len - REGEX_OVERLAP);
+		if (slide > pos) {
+			if (w->buf[slide - w->start - 1] == '\n')
+				eflags &= ~REG_NOTBOL;
+			else
+				eflags |= REG_NOTBOL;
 		}
-		char *next = memchr(cur, 0, len);
-		if (!next)
+		window_fill(w, slide);
+		pos = slide;
+	}
+}
+
+int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	Window w;
+	if (!window_init(&w, txt, pos + len))
+		return REG_NOMATCH;
+	int ret = REG_NOMATCH;
+	for (Filerange m; pos < w.end; pos = m.end) {
+		ret = search_segment(&w, r, pos, eflags, nmatch, pmatch, &m);
+		if (!ret)
 			break;
-		while (!*next && next != end)
-			next++;
-		junk = next - cur;
-		cur = next;
 	}
-	free(buf);
+	free(w.buf);
 	return ret;
 }
 
 int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
+	Window w;
+	if (!window_init(&w, txt, pos + len))
 		return REG_NOMATCH;
-	char *cur = buf, *end = buf + len;
 	int ret = REG_NOMATCH;
-	regmatch_t match[MAX_REGEX_SUB];
-	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
-		char *next;
-		if (!regexec(&r->regex, cur, nmatch, match, eflags)) {
+	for (Filerange m; pos < w.end; ) {
+		size_t next;
+		if (!search_segment(&w, r, pos, eflags, nmatch, pmatch, &m)) {
 			ret = 0;
-			for (size_t i = 0; i < nmatch; i++) {
-				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
-				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
-			}
-
-			if (match[0].rm_so == 0 && match[0].rm_eo == 0) {
+			if (m.start == pos && m.end == pos) {
 				/* empty match at the beginning of cur, advance to next line */
-				next = strchr(cur, '\n');
-				if (!next)
+				for (next = pos; next < w.end; next++) {
+					char c = *window_get(&w, next);
+					if (!c || c == '\n')
+						break;
+				}
+				if (next == w.end || !*window_get(&w, next))
 					break;
 				next++;
 			} else {
-				next = cur + match[0].rm_eo;
+				next = m.end;
 			}
 		} else {
-			next = memchr(cur, 0, len);
-			if (!next)
-				break;
-			while (!*next && next != end)
-				next++;
+			next = m.end;
 		}
-		junk = next - cur;
-		cur = next;
-		if (cur[-1] == '\n')
+		char prev;
+		if (next == pos || !text_byte_get(txt, next - 1, &prev))
+			break;
+		pos = next;
+		if (prev == '\n')
 			eflags &= ~REG_NOTBOL;
 		else
 			eflags |= REG_NOTBOL;
 	}
-	free(buf);
+	free(w.buf);
 	return ret;
 }
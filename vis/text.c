@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -94,6 +95,18 @@ struct Text {
 	size_t size;            /* current file content size in bytes */
 	struct stat info;       /* stat as probed at load time */
 	LineCache lines;        /* mapping between absolute pos in bytes and logical line breaks */
+	size_t version;         /* new whenever the content changes, see versions */
+	size_t born;            /* the version it started with */
+	size_t edits;           /* changes of the version, to index changes */
+	struct {
+		size_t version, pos;
+	} changes[16];          /* where the last changes were */
+	struct {
+		size_t pieces, changes, revisions, blocks; /* allocated */
+		size_t cache_hits, cache_misses;
+		size_t lines_hits, lines_scans, lines_rescans, lines_scanned;
+		atomic_size_t bytes_get; /* also read by other threads */
+	} stats;                /* see text_stats */
 };
 
 /* block management */
@@ -112,6 +125,7 @@ static Location piece_get_extern(const Text *txt, size_t pos);
 /* span management */
 static void span_init(Span *span, Piece *start, Piece *end);
 static void span_swap(Text *txt, Span *old, Span *new);
+static void text_changed(Text *txt, size_t pos);
 /* change management */
 static Change *change_alloc(Text *txt, size_t pos);
 static void change_free(Change *c);
@@ -124,10 +138,12 @@ static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *li
 static size_t lines_count(Text *txt, size_t pos, size_t len);
 
 /* stores the given data in a block, allocates a new one if necessary. Returns
- * a pointer to the storage location or NULL if allocation failed. */
+ * a pointer to the storage location or NULL if allocation failed. A block
+ * shared with other Texts is not appended to, as the cache could not be
+ * used for the data stored there. */
 static const char *block_store(Text *txt, const char *data, size_t len) {
 	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
-	if (!blk || !block_capacity(blk, len)) {
+	if (!blk || blk->refs > 1 || !block_capacity(blk, len)) {
 		blk = block_alloc(len);
 		if (!blk)
 			return NULL;
@@ -135,6 +151,7 @@ static const char *block_store(Text *txt, const char *data, size_t len) {
 			block_free(blk);
 			return NULL;
 		}
+		txt->stats.blocks++;
 	}
 	return block_append(blk, data, len);
 }
@@ -153,6 +170,9 @@ static bool cache_contains(Text *txt, Piece *p) {
 	Revision *rev = txt->current_revision;
 	if (!blk || !txt->cache || txt->cache != p || !rev || !rev->change)
 		return false;
+	/* other Texts have pieces in it, which must not move */
+	if (blk->refs > 1)
+		return false;
 
 	Piece *start = rev->change->new.start;
 	Piece *end = rev->change->new.end;
@@ -241,12 +261,26 @@ static void span_swap(Text *txt, Span *old, Span *new) {
 	txt->size += new->len;
 }
 
+/* versions of all texts are taken from one counter, so a text freed
+ * and another allocated at its address never have the same one */
+static atomic_size_t versions;
+
+/* bump the version of the text, remembering where it changed */
+static void text_changed(Text *txt, size_t pos) {
+	size_t n = sizeof txt->changes / sizeof txt->changes[0];
+	txt->version = atomic_fetch_add_explicit(&versions, 1, memory_order_relaxed) + 1;
+	txt->edits++;
+	txt->changes[txt->edits % n].version = txt->version;
+	txt->changes[txt->edits % n].pos = pos;
+}
+
 /* Allocate a new revision and place it in the revision graph.
  * All further changes will be associated with this revision. */
 static Revision *revision_alloc(Text *txt) {
 	Revision *rev = calloc(1, sizeof *rev);
 	if (!rev)
 		return NULL;
+	txt->stats.revisions++;
 	rev->time = time(NULL);
 	txt->current_revision = rev;
 
@@ -287,6 +321,7 @@ static Piece *piece_alloc(Text *txt) {
 	Piece *p = calloc(1, sizeof *p);
 	if (!p)
 		return NULL;
+	txt->stats.pieces++;
 	p->text = txt;
 	p->global_next = txt->pieces;
 	if (txt->pieces)
@@ -368,6 +403,7 @@ static Change *change_alloc(Text *txt, size_t pos) {
 	Change *c = calloc(1, sizeof *c);
 	if (!c)
 		return NULL;
+	txt->stats.changes++;
 	c->pos = pos;
 	c->next = rev->change;
 	if (rev->change)
@@ -426,8 +462,12 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 	if (!p)
 		return false;
 	size_t off = loc.off;
-	if (cache_insert(txt, p, off, data, len))
+	if (cache_insert(txt, p, off, data, len)) {
+		txt->stats.cache_hits++;
+		text_changed(txt, pos);
 		return true;
+	}
+	txt->stats.cache_misses++;
 
 	Change *c = change_alloc(txt, pos);
 	if (!c)
@@ -467,6 +507,7 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 
 	cache_piece(txt, new);
 	span_swap(txt, &c->old, &c->new);
+	text_changed(txt, pos);
 	return true;
 }
 
@@ -474,6 +515,7 @@ static size_t revision_undo(Text *txt, Revision *rev) {
 	size_t pos = EPOS;
 	for (Change *c = rev->change; c; c = c->next) {
 		span_swap(txt, &c->new, &c->old);
+		text_changed(txt, c->pos);
 		pos = c->pos;
 	}
 	return pos;
@@ -486,6 +528,7 @@ static size_t revision_redo(Text *txt, Revision *rev) {
 		c = c->next;
 	for ( ; c; c = c->prev) {
 		span_swap(txt, &c->old, &c->new);
+		text_changed(txt, c->pos);
 		pos = c->pos;
 		if (c->new.len > c->old.len)
 			pos += c->new.len - c->old.len;
@@ -595,6 +638,7 @@ Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod me
 	Block *block = NULL;
 	array_init(&txt->blocks);
 	lineno_cache_invalidate(&txt->lines);
+	txt->version = txt->born = atomic_fetch_add_explicit(&versions, 1, memory_order_relaxed) + 1;
 	if (filename) {
 		errno = 0;
 		block = block_load(dirfd, filename, method, &txt->info);
@@ -604,6 +648,8 @@ Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod me
 			block_free(block);
 			goto out;
 		}
+		if (block)
+			txt->stats.blocks++;
 	}
 
 	if (!block)
@@ -671,8 +717,12 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	if (!p)
 		return false;
 	size_t off = loc.off;
-	if (cache_delete(txt, p, off, len))
+	if (cache_delete(txt, p, off, len)) {
+		txt->stats.cache_hits++;
+		text_changed(txt, pos);
 		return true;
+	}
+	txt->stats.cache_misses++;
 	Change *c = change_alloc(txt, pos);
 	if (!c)
 		return false;
@@ -737,6 +787,7 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	span_init(&c->new, new_start, new_end);
 	span_init(&c->old, start, end);
 	span_swap(txt, &c->old, &c->new);
+	text_changed(txt, pos);
 	return true;
 }
 
@@ -798,6 +849,32 @@ bool text_mmaped(const Text *txt, const char *ptr) {
 	return false;
 }
 
+TextStats text_stats(const Text *txt) {
+	TextStats stats = {
+		.pieces_total = txt->stats.pieces,
+		.changes = txt->stats.changes,
+		.revisions = txt->stats.revisions,
+		.blocks = array_length(&txt->blocks),
+		.blocks_total = txt->stats.blocks,
+		.cache_hits = txt->stats.cache_hits,
+		.cache_misses = txt->stats.cache_misses,
+		.lines_hits = txt->stats.lines_hits,
+		.lines_scans = txt->stats.lines_scans,
+		.lines_rescans = txt->stats.lines_rescans,
+		.lines_scanned = txt->stats.lines_scanned,
+		.bytes_get = atomic_load_explicit(&txt->stats.bytes_get, memory_order_relaxed),
+	};
+	for (Piece *p = txt->begin.next; p && p->next; p = p->next)
+		stats.pieces++;
+	block_stats(&stats.malloc_bytes, &stats.mmap_bytes);
+	return stats;
+}
+
+/* counts text_bytes_get, which is in text-common.c */
+void text_bytes_counted(const Text *txt, size_t len) {
+	atomic_fetch_add_explicit(&((Text *)txt)->stats.bytes_get, len, memory_order_relaxed);
+}
+
 static bool iterator_init(Iterator *it, size_t pos, Piece *p, size_t off) {
 	*it = (Iterator){
 		.pos = pos,
@@ -854,7 +931,7 @@ size_t text_size(const Text *txt) {
 
 /* count the number of new lines '\n' in range [pos, pos+len) */
 static size_t lines_count(Text *txt, size_t pos, size_t len) {
-	size_t lines = 0;
+	size_t lines = 0, len_old = len;
 	for (Iterator it = text_iterator_get(txt, pos);
 	     text_iterator_valid(&it);
 	     text_iterator_next(&it)) {
@@ -874,12 +951,13 @@ static size_t lines_count(Text *txt, size_t pos, size_t len) {
 		if (len == 0)
 			break;
 	}
+	txt->stats.lines_scanned += len_old - len;
 	return lines;
 }
 
 /* skip n lines forward and return position afterwards */
 static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skipped) {
-	size_t lines_old = lines;
+	size_t lines_old = lines, pos_old = pos;
 	for (Iterator it = text_iterator_get(txt, pos);
 	     text_iterator_valid(&it);
 	     text_iterator_next(&it)) {
@@ -901,6 +979,7 @@ static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *li
 	}
 	if (lines_skipped)
 		*lines_skipped = lines_old - lines;
+	txt->stats.lines_scanned += pos - pos_old;
 	return pos;
 }
 
@@ -914,6 +993,12 @@ size_t text_pos_by_lineno(Text *txt, size_t lineno) {
 	LineCache *cache = &txt->lines;
 	if (lineno <= 1)
 		return 0;
+	if (lineno == cache->lineno)
+		txt->stats.lines_hits++;
+	else if (lineno > cache->lineno)
+		txt->stats.lines_scans++;
+	else
+		txt->stats.lines_rescans++;
 	if (lineno > cache->lineno) {
 		cache->pos = lines_skip_forward(txt, cache->pos, lineno - cache->lineno, &lines_skipped);
 		cache->lineno += lines_skipped;
@@ -935,6 +1020,12 @@ size_t text_lineno_by_pos(Text *txt, size_t pos) {
 	LineCache *cache = &txt->lines;
 	if (pos > txt->size)
 		pos = txt->size;
+	if (pos == cache->pos)
+		txt->stats.lines_hits++;
+	else if (pos < cache->pos && cache->pos - pos >= pos)
+		txt->stats.lines_rescans++;
+	else
+		txt->stats.lines_scans++;
 	if (pos < cache->pos) {
 		size_t diff = cache->pos - pos;
 		if (diff < pos)
@@ -996,3 +1087,211 @@ size_t text_undo_emacs(Text *txt, int n) {
 
 	return pos;
 }
+
+size_t text_version(const Text *txt) {
+	return txt->version;
+}
+
+/* lowest position changed after version, EPOS if nothing changed and 0
+ * if that is too long ago to tell or the version is not one of txt */
+size_t text_changed_since(const Text *txt, size_t version) {
+	size_t n = sizeof txt->changes / sizeof txt->changes[0];
+	size_t pos = EPOS;
+	if (version < txt->born || version > txt->version)
+		return 0;
+	size_t e;
+	for (e = txt->edits; e > 0 && txt->edits - e < n; e--) {
+		if (txt->changes[e % n].version <= version)
+			return pos;
+		if (txt->changes[e % n].pos < pos)
+			pos = txt->changes[e % n].pos;
+	}
+	/* unless all of its changes were seen, some are forgotten */
+	return e == 0 ? pos : 0;
+}
+
+/* a block of the source of text_insert_text, and whether the text
+ * inserted into holds it too */
+typedef struct {
+	Block *block;
+	bool held;
+} SharedBlock;
+
+/* bytes of the shared blocks the text inserted into shows */
+typedef struct {
+	const char *start, *end;
+} Shown;
+
+static int shared_cmp(const void *a, const void *b) {
+	const char *x = ((const SharedBlock*)a)->block->data;
+	const char *y = ((const SharedBlock*)b)->block->data;
+	return x < y ? -1 : x > y;
+}
+
+static int shown_cmp(const void *a, const void *b) {
+	const char *x = ((const Shown*)a)->start, *y = ((const Shown*)b)->start;
+	return x < y ? -1 : x > y;
+}
+
+/* the block last in address order starting at or before data */
+static SharedBlock *shared_find(const Array *blocks, const char *data) {
+	size_t lo = 0, hi = array_length(blocks);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		SharedBlock *s = array_get(blocks, mid);
+		if (s->block->data <= data)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? array_get(blocks, lo - 1) : NULL;
+}
+
+/* the blocks of src sorted by address, with those txt holds marked,
+ * and the bytes of them txt shows, sorted and merged: one walk over
+ * the pieces of txt for all the data inserted */
+static bool shared_init(Array *blocks, Array *shown, const Text *txt, const Text *src) {
+	array_init_sized(blocks, sizeof(SharedBlock));
+	array_init_sized(shown, sizeof(Shown));
+	if (!array_reserve(blocks, array_length(&src->blocks)))
+		return false;
+	for (size_t i = 0, n = array_length(&src->blocks); i < n; i++) {
+		SharedBlock s = { array_get_ptr(&src->blocks, i), false };
+		array_add(blocks, &s);
+	}
+	array_sort(blocks, shared_cmp);
+
+	bool any = false;
+	for (size_t i = 0, n = array_length(&txt->blocks); i < n; i++) {
+		Block *b = array_get_ptr(&txt->blocks, i);
+		SharedBlock *s = shared_find(blocks, b->data);
+		if (s && s->block == b)
+			any = s->held = true;
+	}
+	if (!any)
+		return true;
+
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		SharedBlock *s = shared_find(blocks, p->data);
+		if (!s || !s->held || p->data >= s->block->data + s->block->len)
+			continue;
+		Shown r = { p->data, p->data + p->len };
+		if (!array_add(shown, &r))
+			return false;
+	}
+	array_sort(shown, shown_cmp);
+
+	size_t n = 0;
+	for (size_t i = 0, len = array_length(shown); i < len; i++) {
+		Shown *r = array_get(shown, i), *last = n ? array_get(shown, n - 1) : NULL;
+		if (last && r->start <= last->end)
+			last->end = MAX(last->end, r->end);
+		else if (n++ != i)
+			array_set(shown, n - 1, r);
+	}
+	array_truncate(shown, n);
+	return true;
+}
+
+/* whether txt shows any of the len bytes at data */
+static bool shown_overlaps(const Array *shown, const char *data, size_t len) {
+	size_t lo = 0, hi = array_length(shown);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Shown *r = array_get(shown, mid);
+		if (r->end <= data)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	Shown *r = array_get(shown, lo);
+	return r && r->start < data + len;
+}
+
+/* data of src, as txt can refer to it: the block holding it is shared
+ * unless txt shows that data already, then it is copied to keep marks
+ * unambiguous */
+static const char *block_share(Text *txt, Array *blocks, const Array *shown, const char *data, size_t len) {
+	SharedBlock *s = shared_find(blocks, data);
+	if (!s || data + len > s->block->data + s->block->len)
+		return block_store(txt, data, len);
+	if (s->held)
+		return shown_overlaps(shown, data, len) ? block_store(txt, data, len) : data;
+
+	if (!array_add_ptr(&txt->blocks, s->block))
+		return NULL;
+	s->block->refs++;
+	s->held = true;
+	txt->stats.blocks++;
+	return data;
+}
+
+/* insert len bytes of src starting at from, by new pieces referring to
+ * the blocks of src rather than a copy of the data */
+bool text_insert_text(Text *txt, size_t pos, const Text *src, size_t from, size_t len) {
+	if (len == 0)
+		return true;
+	if (pos > txt->size || from > src->size || len > src->size - from)
+		return false;
+	if (pos < txt->lines.pos)
+		lineno_cache_invalidate(&txt->lines);
+
+	Location loc = piece_get_intern(txt, pos);
+	Piece *p = loc.piece;
+	if (!p)
+		return false;
+	size_t off = loc.off;
+
+	Change *c = change_alloc(txt, pos);
+	if (!c)
+		return false;
+
+	/* the new pieces, chained up but not yet part of the text */
+	Piece *first = NULL, *last = NULL;
+	Location s = piece_get_extern(src, from);
+	size_t soff = s.off, rem = len;
+	Array blocks, shown;
+	bool ok = shared_init(&blocks, &shown, txt, src);
+	for (Piece *sp = s.piece; ok && rem > 0 && sp && sp->next; sp = sp->next, soff = 0) {
+		size_t n = MIN(sp->len - soff, rem);
+		if (n == 0)
+			continue;
+		const char *data = block_share(txt, &blocks, &shown, sp->data + soff, n);
+		Piece *new = piece_alloc(txt);
+		if (!(ok = data && new))
+			break;
+		piece_init(new, last, NULL, data, n);
+		if (last)
+			last->next = new;
+		else
+			first = new;
+		last = new;
+		rem -= n;
+	}
+	array_release(&blocks);
+	array_release(&shown);
+	if (!ok || !first || rem > 0)
+		return false;
+
+	if (off == p->len) {
+		first->prev = p;
+		last->next = p->next;
+		span_init(&c->new, first, last);
+		span_init(&c->old, NULL, NULL);
+	} else {
+		Piece *before = piece_alloc(txt);
+		Piece *after = piece_alloc(txt);
+		if (!before || !after)
+			return false;
+		piece_init(before, p->prev, first, p->data, off);
+		piece_init(after, last, p->next, p->data + off, p->len - off);
+		first->prev = before;
+		last->next = after;
+		span_init(&c->new, before, after);
+		span_init(&c->old, p, p);
+	}
+
+	span_swap(txt, &c->old, &c->new);
+	text_changed(txt, pos);
+	return true;
+}
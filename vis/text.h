@@ -147,6 +147,24 @@ bool text_modified(const Text*);
  * @return Whether the insertion succeeded.
  */
 bool text_insert(Text*, size_t pos, const char *data, size_t len);
+/**
+ * Insert a range of another text at the given byte position, by
+ * referring to the blocks holding its data rather than copying it.
+ *
+ * @param pos The absolute byte position.
+ * @param src The text to take the data from.
+ * @param from The absolute byte position in ``src``.
+ * @param len The length of the range in bytes.
+ * @return Whether the insertion succeeded.
+ * @rst
+ * .. note:: Data this text already shows, as when ``src`` was filled
+ *           from it and nothing was deleted since, is copied instead,
+ *           so that marks stay unambiguous.  Data it only showed
+ *           before is referred to again, so a mark set on it then
+ *           resolves to the inserted range.
+ * @endrst
+ */
+bool text_insert_text(Text*, size_t pos, const Text *src, size_t from, size_t len);
 /**
  * Delete data at given byte position.
  *
@@ -413,6 +431,33 @@ ssize_t text_write_range(const Text*, const Filerange*, int fd);
  * this text instance.
  */
 bool text_mmaped(const Text*, const char *ptr);
+/**
+ * Counters of the work done for a text, to see why editing it got slow.
+ */
+typedef struct {
+	size_t pieces;         /**< Pieces the text consists of now. */
+	size_t pieces_total;   /**< Pieces allocated, the others are kept for undo. */
+	size_t changes;        /**< Changes recorded, all kept until the text is freed. */
+	size_t revisions;      /**< Revisions recorded, likewise. */
+	size_t blocks;         /**< Blocks holding the content of the text. */
+	size_t blocks_total;   /**< Blocks ever added to the text. */
+	size_t malloc_bytes;   /**< Held in heap allocated blocks, by all texts. */
+	size_t mmap_bytes;     /**< Held in memory mapped blocks, by all texts. */
+	size_t cache_hits;     /**< Insertions and deletions done in the last changed piece. */
+	size_t cache_misses;   /**< Insertions and deletions which needed new pieces. */
+	size_t lines_hits;     /**< Line lookups answered by the cached line alone. */
+	size_t lines_scans;    /**< Line lookups scanning on from the cached line. */
+	size_t lines_rescans;  /**< Line lookups scanning from the start of the text. */
+	size_t lines_scanned;  /**< Bytes searched for newlines by line lookups. */
+	size_t bytes_get;      /**< Bytes copied by ``text_bytes_get``. */
+} TextStats;
+/**
+ * Get the counters of the text.
+ * @rst
+ * .. note:: Takes time linear in the number of pieces, to count those in use.
+ * @endrst
+ */
+TextStats text_stats(const Text*);
 /** @} */
 
 #endif
@@ -0,0 +1,476 @@
+/* vt - te's own terminal output, see vt.h */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include <curses.h>  /* only for the A_ attributes te uses */
+
+#define VT_IMPL
+#include "vt.h"
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+#define MAX(a, b)  ((a) < (b) ? (b) : (a))
+
+#define VT_ATTRS (A_BOLD | A_REVERSE)
+
+typedef struct {
+	char s[8];              /* UTF-8 of what it shows */
+	unsigned char len;      /* 0 for the right half of a wide character */
+	unsigned char width;
+	int attr;
+} Cell;
+
+static const Cell blank = { " ", 1, 1, 0 };
+
+static struct {
+	int lines, cols;
+	Cell *front;            /* what the terminal shows */
+	Cell *back;             /* what the next vt_refresh makes it show */
+	int full;               /* front is not known, draw everything */
+
+	int y, x, attr;         /* where and how te draws */
+	int top, bot;           /* scrolling region */
+
+	int ty, tx, tattr;      /* the terminal's cursor, ty < 0 if unknown */
+
+	char *out;              /* what goes to the terminal next */
+	size_t len, size;
+
+	struct termios saved;   /* the modes to leave the terminal in */
+	int ended;              /* vt_endwin left them */
+} vt;
+
+static void
+out(const char *s, size_t n)
+{
+	if (vt.len + n > vt.size) {
+		size_t size = MAX(2 * vt.size, vt.len + n + 4096);
+		char *o = realloc(vt.out, size);
+		if (!o)
+			return;
+		vt.out = o;
+		vt.size = size;
+	}
+	memcpy(vt.out + vt.len, s, n);
+	vt.len += n;
+}
+
+static void
+outf(const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	out(buf, MIN(n, (int)sizeof buf - 1));
+}
+
+static void
+out_flush(void)
+{
+	size_t done = 0;
+
+	while (done < vt.len) {
+		ssize_t n = write(1, vt.out + done, vt.len - done);
+		if (n < 0)
+			break;
+		done += n;
+	}
+	vt.len = 0;
+}
+
+/* Follow the size of the terminal, forgetting the screen if it
+   changed */
+static void
+vt_size(void)
+{
+	struct winsize ws;
+	int lines = 24, cols = 80;
+
+	if (ioctl(1, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+		lines = ws.ws_row;
+		cols = ws.ws_col;
+	}
+	if (vt.front && lines == vt.lines && cols == vt.cols)
+		return;
+
+	/* both are redrawn in full, keep the old ones unless both come */
+	Cell *front = malloc(lines * cols * sizeof *front);
+	Cell *back = malloc(lines * cols * sizeof *back);
+	if (!front || !back) {
+		free(front);
+		free(back);
+		return;
+	}
+	free(vt.front);
+	free(vt.back);
+	vt.front = front;
+	vt.back = back;
+	vt.lines = lines;
+	vt.cols = cols;
+	for (int i = 0; i < lines * cols; i++)
+		vt.back[i] = blank;
+	vt.top = 0;
+	vt.bot = lines - 1;
+	vt.y = MIN(vt.y, lines - 1);
+	vt.x = MIN(vt.x, cols - 1);
+	vt.full = 1;
+}
+
+/* Keys come as they are typed, and output goes out as it is */
+void
+vt_raw(void)
+{
+	struct termios t = vt.saved;
+
+	t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
+	    ICRNL | IXON);
+	t.c_oflag &= ~OPOST;
+	t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	t.c_cflag = (t.c_cflag & ~(CSIZE | PARENB)) | CS8;
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	tcsetattr(0, TCSADRAIN, &t);
+}
+
+void
+vt_init(void)
+{
+	tcgetattr(0, &vt.saved);
+	vt_raw();
+	out("\e[?1049h", 8);  /* the alternate screen */
+	vt.ty = -1;
+	vt.full = 1;
+	vt_size();
+}
+
+void
+vt_endwin(void)
+{
+	out("\e[m", 3);
+	outf("\e[%d;1H", vt.lines);
+	out("\e[?1049l", 8);
+	out_flush();
+	tcsetattr(0, TCSADRAIN, &vt.saved);
+	vt.full = 1;
+	vt.ended = 1;
+}
+
+void
+vt_clearok(void)
+{
+	vt.full = 1;
+}
+
+void
+vt_flash(void)
+{
+	struct timespec ts = { 0, 100000000 };
+
+	out("\e[?5h", 5);
+	out_flush();
+	nanosleep(&ts, 0);
+	out("\e[?5l", 5);
+	out_flush();
+}
+
+void
+vt_move(int y, int x)
+{
+	vt.y = y;
+	vt.x = x;
+}
+
+void
+vt_getyx(int *y, int *x)
+{
+	*y = vt.y;
+	*x = vt.x;
+}
+
+void
+vt_getmaxyx(int *y, int *x)
+{
+	vt_size();
+	*y = vt.lines;
+	*x = vt.cols;
+}
+
+/* Put a character of width 1 or 2 where te draws, clipped at the
+   right margin */
+static void
+put(const char *s, int len, int width)
+{
+	if (vt.y < 0 || vt.y >= vt.lines || vt.x < 0 ||
+	    vt.x + width > vt.cols) {
+		vt.x += width;
+		return;
+	}
+
+	Cell *row = vt.back + vt.y * vt.cols;
+	int x = vt.x;
+
+	/* don't leave half of a wide character behind */
+	if (row[x].len == 0 && x > 0)
+		row[x - 1] = blank;
+	if (row[x + width - 1].width == 2 && x + width < vt.cols)
+		row[x + width] = blank;
+
+	memcpy(row[x].s, s, len);
+	row[x].len = len;
+	row[x].width = width;
+	row[x].attr = vt.attr;
+	if (width == 2)
+		row[x + 1] = (Cell){ "", 0, 0, vt.attr };
+	vt.x += width;
+}
+
+void
+vt_addch(int c)
+{
+	char ch = c;
+	put(&ch, 1, 1);
+}
+
+void
+vt_addnstr(const char *s, int n)
+{
+	mbstate_t mbstate = { 0 };
+	size_t len = n < 0 ? strlen(s) : strnlen(s, n);
+
+	while (len > 0) {
+		wchar_t wc;
+		size_t l = mbrtowc(&wc, s, len, &mbstate);
+		int w;
+
+		if (l == (size_t)-1 || l == (size_t)-2) {
+			mbstate = (mbstate_t){ 0 };
+			put("?", 1, 1);
+			l = 1;
+		} else if (l == 0 || wc < 0x20 || wc == 0x7f) {
+			char ctl[2] = { '^', wc == 0x7f ? '?' : '@' + wc };
+			put(ctl, 1, 1);
+			put(ctl + 1, 1, 1);
+			l = MAX(l, 1);
+		} else if ((w = wcwidth(wc)) == 0) {
+			/* a combining character joins the one before */
+			if (vt.y >= 0 && vt.y < vt.lines &&
+			    vt.x > 0 && vt.x <= vt.cols) {
+				Cell *c = vt.back + vt.y * vt.cols + vt.x - 1;
+				if (c->len == 0 && vt.x > 1)
+					c--;
+				if (c->len + l <= sizeof c->s) {
+					memcpy(c->s + c->len, s, l);
+					c->len += l;
+				}
+			}
+		} else {
+			put(s, l, w < 0 ? 1 : w);
+		}
+		s += l;
+		len -= l;
+	}
+}
+
+void
+vt_printw(const char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	vt_addnstr(buf, -1);
+}
+
+void
+vt_attron(int attr)
+{
+	vt.attr |= attr & VT_ATTRS;
+}
+
+void
+vt_attroff(int attr)
+{
+	vt.attr &= ~attr;
+}
+
+void
+vt_clrtoeol(void)
+{
+	if (vt.y < 0 || vt.y >= vt.lines)
+		return;
+	Cell *row = vt.back + vt.y * vt.cols;
+	int x = MAX(vt.x, 0);
+	if (x < vt.cols && row[x].len == 0 && x > 0)
+		row[x - 1] = blank;
+	for (; x < vt.cols; x++)
+		row[x] = blank;
+}
+
+void
+vt_chgat(int y, int x, int n, int attr)
+{
+	if (y < 0 || y >= vt.lines)
+		return;
+	if (n < 0 || x + n > vt.cols)
+		n = vt.cols - x;
+	for (Cell *c = vt.back + y * vt.cols + x; n-- > 0; c++)
+		c->attr = attr & VT_ATTRS;
+}
+
+void
+vt_setscrreg(int top, int bot)
+{
+	vt.top = MAX(top, 0);
+	vt.bot = MIN(bot, vt.lines - 1);
+}
+
+static void
+sgr(int attr)
+{
+	if (attr == vt.tattr)
+		return;
+	outf("\e[0%s%sm", attr & A_BOLD ? ";1" : "",
+	    attr & A_REVERSE ? ";7" : "");
+	vt.tattr = attr;
+}
+
+/* Scroll the scrolling region up by n rows, or down if n is negative.
+   What te drew and what the terminal shows move along, so only the
+   rows that come in still need drawing. */
+void
+vt_scroll(int n)
+{
+	int rows = vt.bot - vt.top + 1, k = abs(n);
+	if (n == 0 || rows <= 0)
+		return;
+	k = MIN(k, rows);
+
+	Cell *grids[] = { vt.back, vt.front };
+	for (int g = 0; g < 2; g++) {
+		Cell *top = grids[g] + vt.top * vt.cols;
+		size_t keep = (rows - k) * vt.cols;
+		if (n > 0) {
+			memmove(top, top + k * vt.cols, keep * sizeof *top);
+			top += keep;
+		} else {
+			memmove(top + k * vt.cols, top, keep * sizeof *top);
+		}
+		for (int i = 0; i < k * vt.cols; i++)
+			top[i] = blank;
+	}
+	if (vt.full)
+		return;
+
+	sgr(0);  /* rows coming in are blank */
+	outf("\e[%d;%dr", vt.top + 1, vt.bot + 1);
+	outf(n > 0 ? "\e[%dS" : "\e[%dT", k);
+	out("\e[r", 3);
+	vt.ty = -1;  /* setting the region moved the cursor */
+}
+
+/* Move the terminal's cursor to y, x the shortest way that we know */
+static void
+cursor_to(int y, int x)
+{
+	if (y == vt.ty && x == vt.tx)
+		return;
+
+	if (y == vt.ty && vt.tx < vt.cols) {
+		if (x == 0) {
+			out("\r", 1);
+		} else if (x < vt.tx) {
+			outf("\e[%dD", vt.tx - x);
+		} else {
+			/* writing a few unchanged cells again is shorter */
+			Cell *c = vt.front + y * vt.cols + vt.tx;
+			int i, n = x - vt.tx;
+			for (i = 0; i < n && n <= 4; i++)
+				if (c[i].len != 1 || c[i].width != 1 ||
+				    c[i].attr != vt.tattr)
+					break;
+			if (i == n && n <= 4) {
+				for (i = 0; i < n; i++)
+					out(c[i].s, 1);
+			} else {
+				outf("\e[%dC", n);
+			}
+		}
+	} else if (vt.ty >= 0 && y == vt.ty + 1 && x == 0) {
+		out("\r\n", 2);
+	} else if (y == 0 && x == 0) {
+		out("\e[H", 3);
+	} else {
+		outf("\e[%d;%dH", y + 1, x + 1);
+	}
+	vt.ty = y;
+	vt.tx = x;
+}
+
+/* Write the cells that changed since the last time, and put the
+   cursor where te drew last */
+void
+vt_refresh(void)
+{
+	if (vt.ended) {
+		/* back from a shell */
+		vt_raw();
+		out("\e[?1049h", 8);
+		vt.full = 1;
+		vt.ended = 0;
+	}
+	vt_size();
+	if (!vt.back)
+		return;
+
+	if (vt.full) {
+		out("\e[m\e[H\e[2J", 10);
+		for (int i = 0; i < vt.lines * vt.cols; i++)
+			vt.front[i] = blank;
+		vt.ty = vt.tx = vt.tattr = 0;
+		vt.full = 0;
+	}
+
+	for (int y = 0; y < vt.lines; y++) {
+		Cell *back = vt.back + y * vt.cols;
+		Cell *front = vt.front + y * vt.cols;
+
+		for (int x = 0; x < vt.cols; x++) {
+			if (back[x].len == front[x].len &&
+			    back[x].attr == front[x].attr &&
+			    memcmp(back[x].s, front[x].s, back[x].len) == 0)
+				continue;
+			if (back[x].len == 0) {
+				/* right half, the wide character is drawn */
+				if (x == 0)
+					continue;
+				x--;
+			}
+
+			cursor_to(y, x);
+			sgr(back[x].attr);
+			out(back[x].s, back[x].len);
+			front[x] = back[x];
+			if (back[x].width == 2 && x + 1 < vt.cols)
+				front[x + 1] = back[x + 1];
+			x += back[x].width - 1;
+			vt.tx = x + 1;
+		}
+	}
+
+	cursor_to(MIN(vt.y, vt.lines - 1), MIN(vt.x, vt.cols - 1));
+	out_flush();
+}
@@ -0,0 +1,72 @@
+/* vt - te's own terminal output, instead of curses drawing
+
+   vt keeps what is on the terminal and what te draws next as grids
+   of cells.  vt_refresh writes only the cells that differ, with as
+   few cursor movements and attribute changes as it can, in a single
+   write.  It also sets up the terminal, so te doesn't initialize
+   curses at all.  Build te with -DTE_VT (make te-vt) to use it. */
+
+#ifndef VT_H
+#define VT_H
+
+void vt_init(void);
+void vt_raw(void);
+void vt_endwin(void);
+void vt_refresh(void);
+void vt_clearok(void);
+void vt_flash(void);
+
+void vt_move(int y, int x);
+void vt_getyx(int *y, int *x);
+void vt_getmaxyx(int *y, int *x);
+void vt_addch(int c);
+void vt_addnstr(const char *s, int n);
+void vt_printw(const char *fmt, ...);
+void vt_attron(int attr);
+void vt_attroff(int attr);
+void vt_clrtoeol(void);
+void vt_chgat(int y, int x, int n, int attr);
+void vt_setscrreg(int top, int bot);
+void vt_scroll(int n);
+
+/* the curses calls te draws with go to vt */
+#ifndef VT_IMPL
+#undef move
+#undef getyx
+#undef getmaxyx
+#undef addch
+#undef mvaddch
+#undef addnstr
+#undef addstr
+#undef attron
+#undef attroff
+#undef clrtoeol
+#undef mvchgat
+#undef setscrreg
+#undef refresh
+#undef raw
+
+#define move(y, x)              vt_move(y, x)
+#define getyx(w, y, x)          vt_getyx(&(y), &(x))
+#define getmaxyx(w, y, x)       vt_getmaxyx(&(y), &(x))
+#define addch(c)                vt_addch(c)
+#define mvaddch(y, x, c)        (vt_move(y, x), vt_addch(c))
+#define addnstr(s, n)           vt_addnstr(s, n)
+#define addstr(s)               vt_addnstr(s, -1)
+#define printw                  vt_printw
+#define attron(a)               vt_attron(a)
+#define attroff(a)              vt_attroff(a)
+#define clrtoeol()              vt_clrtoeol()
+#define mvchgat(y, x, n, a, c, o)  vt_chgat(y, x, n, a)
+#define setscrreg(top, bot)     vt_setscrreg(top, bot)
+#define scrollok(w, b)          ((void)0)
+#define idlok(w, b)             ((void)0)
+#define wscrl(w, n)             vt_scroll(n)
+#define clearok(w, b)           vt_clearok()
+#define refresh()               vt_refresh()
+#define flash()                 vt_flash()
+#define endwin()                vt_endwin()
+#define raw()                   vt_raw()
+#endif
+
+#endif